@@ -28,7 +28,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 /* Use the newer ALSA API */
 #define ALSA_PCM_NEW_HW_PARAMS_API
 
+#include "shpotify.h"
+
 #include <alsa/asoundlib.h>
+#include <pthread.h>
+#include <stdbool.h>
 
 static snd_pcm_t *handle;
 static snd_pcm_hw_params_t *params;
@@ -38,24 +42,27 @@ static snd_pcm_uframes_t frames;
 
 static int g_paused;
 
+/* The device is opened by the first sound_* call that needs it, not to
+   delay the start.  The calls come from the libspotify threads.  */
+static pthread_once_t g_open_once = PTHREAD_ONCE_INIT;
+static int g_open_error;
+
 #define CHANNELS 2
 #define RATE     44100
 #define FRAMES   32
 
-int
-sound_init ()
+static int
+sound_open_device ()
 {
   int rc;
 
   rc = snd_pcm_open (&handle, "default", SND_PCM_STREAM_PLAYBACK, 0);
   if (rc < 0)
     {
-      fprintf (stderr, "unable to open pcm device: %s\n", snd_strerror (rc));
+      handle = NULL;
       return rc;
     }
 
-  g_paused = 0;
-
   snd_pcm_hw_params_alloca (&params);
 
   snd_pcm_hw_params_any (handle, params);
@@ -84,9 +91,40 @@ sound_init ()
   return 0;
 }
 
+static void
+sound_open ()
+{
+  int rc = sound_open_device ();
+
+  if (rc < 0 && handle)
+    {
+      snd_pcm_close (handle);
+      handle = NULL;
+    }
+  __atomic_store_n (&g_open_error, rc < 0 ? rc : 0, __ATOMIC_RELEASE);
+}
+
+static bool
+sound_ready ()
+{
+  pthread_once (&g_open_once, sound_open);
+  return handle != NULL;
+}
+
+/* Why the device could not be opened, or NULL.  */
+const char *
+sound_error ()
+{
+  int rc = __atomic_load_n (&g_open_error, __ATOMIC_ACQUIRE);
+  return rc < 0 ? snd_strerror (rc) : NULL;
+}
+
 int
 sound_flush ()
 {
+  if (!sound_ready ())
+    return 0;
+
   snd_pcm_drop (handle);
   snd_pcm_prepare (handle);
   return 0;
@@ -98,6 +136,9 @@ sound_get_buffer ()
   int ret;
   snd_pcm_uframes_t buffer_size, period_size;
 
+  if (!sound_ready ())
+    return 0;
+
   ret = snd_pcm_get_params (handle, &buffer_size, &period_size);
   if (ret < 0)
     return 0;
@@ -116,10 +157,15 @@ sound_write (const char *buffer, int frames)
   if (g_paused)
     return 0;
 
+  /* Without a device the audio is dropped.  */
+  if (!sound_ready ())
+    return frames;
+
  restart:
   rc = snd_pcm_writei (handle, buffer, frames);
   if (rc == -EPIPE)
     {
+      metrics_count (METRIC_UNDERRUNS, 1);
       snd_pcm_prepare (handle);
       goto restart;
     }
@@ -130,6 +176,9 @@ sound_write (const char *buffer, int frames)
 int
 sound_clean ()
 {
+  if (handle == NULL)
+    return 0;
+
   snd_pcm_drop (handle);
   snd_pcm_close (handle);
 
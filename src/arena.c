@@ -0,0 +1,108 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shpotify.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+struct arena_chunk
+{
+  struct arena_chunk *next;
+  size_t size;
+  size_t used;
+};
+
+#define CHUNK_HEADER ARENA_ROUND (sizeof (struct arena_chunk))
+
+void *
+arena_alloc (struct arena *a, size_t size)
+{
+  struct arena_chunk *c = a->current;
+  char *p;
+
+  size = ARENA_ROUND (max (size, 1));
+
+  /* Reuse the chunks kept by arena_reset first.  */
+  while (c && c->used + size > c->size)
+    c = c->next;
+
+  if (c == NULL)
+    {
+      size_t n = max (size, ARENA_CHUNK_SIZE);
+      c = malloc (CHUNK_HEADER + n);
+      if (c == NULL)
+        return NULL;
+
+      c->next = NULL;
+      c->size = n;
+      c->used = 0;
+      if (a->last)
+        a->last->next = c;
+      else
+        a->chunks = c;
+      a->last = c;
+    }
+
+  a->current = c;
+  p = (char *) c + CHUNK_HEADER + c->used;
+  c->used += size;
+  memset (p, 0, size);
+  return p;
+}
+
+/* Forget everything allocated from A.  The chunks are kept for the next
+   allocations, except the ones made for a single big block.  */
+void
+arena_reset (struct arena *a)
+{
+  struct arena_chunk *c = a->chunks, *next;
+
+  a->chunks = a->last = a->current = NULL;
+  for (; c; c = next)
+    {
+      next = c->next;
+      if (c->size > ARENA_CHUNK_SIZE)
+        {
+          free (c);
+          continue;
+        }
+
+      c->next = NULL;
+      c->used = 0;
+      if (a->last)
+        a->last->next = c;
+      else
+        a->chunks = c;
+      a->last = c;
+    }
+
+  a->current = a->chunks;
+}
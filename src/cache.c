@@ -0,0 +1,322 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shpotify.h"
+
+#include <string.h>
+#include <time.h>
+
+/* Cache of the links returned by a search, keyed on the query, the
+   searched category and the offset.  The most recently used entry is
+   the first of the list.  */
+struct cache_entry
+{
+  struct cache_entry *next, *prev;
+  char *query;
+  int type;
+  int offset;
+  time_t stored;
+  int n_links;
+  char **links;
+};
+
+static struct cache_entry *g_head, *g_tail;
+static int g_entries, g_max_entries;
+static int g_ttl;
+static char *g_path;
+static unsigned long g_hits, g_misses;
+
+static void
+entry_unlink (struct cache_entry *e)
+{
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    g_head = e->next;
+
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    g_tail = e->prev;
+
+  e->next = e->prev = NULL;
+  g_entries--;
+}
+
+static void
+entry_push_front (struct cache_entry *e)
+{
+  e->prev = NULL;
+  e->next = g_head;
+  if (g_head)
+    g_head->prev = e;
+  g_head = e;
+  if (g_tail == NULL)
+    g_tail = e;
+  g_entries++;
+}
+
+static void
+entry_push_back (struct cache_entry *e)
+{
+  e->next = NULL;
+  e->prev = g_tail;
+  if (g_tail)
+    g_tail->next = e;
+  g_tail = e;
+  if (g_head == NULL)
+    g_head = e;
+  g_entries++;
+}
+
+static void
+entry_free (struct cache_entry *e)
+{
+  int i;
+
+  for (i = 0; i < e->n_links; i++)
+    free (e->links[i]);
+  free (e->links);
+  free (e->query);
+  free (e);
+}
+
+static struct cache_entry *
+entry_find (const char *query, int type, int offset)
+{
+  struct cache_entry *e;
+
+  for (e = g_head; e; e = e->next)
+    if (e->type == type && e->offset == offset && strcmp (e->query, query) == 0)
+      return e;
+
+  return NULL;
+}
+
+static bool
+entry_expired (struct cache_entry *e)
+{
+  return time (NULL) - e->stored > g_ttl;
+}
+
+static void
+cache_evict ()
+{
+  while (g_entries > g_max_entries && g_tail)
+    {
+      struct cache_entry *e = g_tail;
+      entry_unlink (e);
+      entry_free (e);
+    }
+}
+
+/* Take ownership of LINKS.  Older entries, as the ones read from the
+   disk, are added as the least recently used.  */
+static struct cache_entry *
+entry_add (const char *query, int type, int offset, time_t stored,
+           char **links, int n_links, bool older)
+{
+  struct cache_entry *e = calloc (sizeof (struct cache_entry), 1);
+  if (e == NULL)
+    {
+      while (n_links--)
+        free (links[n_links]);
+      free (links);
+      return NULL;
+    }
+
+  e->query = strdup (query);
+  e->type = type;
+  e->offset = offset;
+  e->stored = stored;
+  e->links = links;
+  e->n_links = n_links;
+
+  if (older)
+    entry_push_back (e);
+  else
+    entry_push_front (e);
+  cache_evict ();
+  return e;
+}
+
+/* The file has a header line for every entry:
+
+   <stored> <type> <offset> <n_links> <query>
+
+   followed by N_LINKS lines, one link each.  */
+static void
+cache_load ()
+{
+  char line[1024];
+  FILE *in = fopen (g_path, "r");
+  if (in == NULL)
+    return;
+
+  while (fgets (line, sizeof line, in))
+    {
+      long stored;
+      int type, offset, n, i, len;
+      char **links;
+
+      if (sscanf (line, "%ld %d %d %d %n", &stored, &type, &offset, &n, &len) < 4
+          || n < 0)
+        break;
+
+      line[strcspn (line, "\n")] = '\0';
+
+      links = calloc (n + 1, sizeof (char *));
+      if (links == NULL)
+        break;
+
+      for (i = 0; i < n; i++)
+        {
+          char link[256];
+          if (fgets (link, sizeof link, in) == NULL)
+            break;
+          link[strcspn (link, "\n")] = '\0';
+          links[i] = strdup (link);
+        }
+
+      /* The file is written from the most recently used entry.  */
+      if (time (NULL) - stored <= g_ttl && i == n
+          && g_entries < g_max_entries
+          && entry_find (line + len, type, offset) == NULL)
+        {
+          entry_add (line + len, type, offset, stored, links, n, true);
+          continue;
+        }
+
+      while (i--)
+        free (links[i]);
+      free (links);
+    }
+
+  fclose (in);
+}
+
+void
+cache_save ()
+{
+  struct cache_entry *e;
+  FILE *out;
+  int i;
+
+  if (g_path == NULL)
+    return;
+
+  out = fopen (g_path, "w");
+  if (out == NULL)
+    return;
+
+  for (e = g_head; e; e = e->next)
+    {
+      if (entry_expired (e))
+        continue;
+
+      fprintf (out, "%ld %d %d %d %s\n", (long) e->stored, e->type,
+               e->offset, e->n_links, e->query);
+      for (i = 0; i < e->n_links; i++)
+        fprintf (out, "%s\n", e->links[i]);
+    }
+
+  fclose (out);
+}
+
+void
+cache_init (const char *path, int max_entries, int ttl)
+{
+  g_max_entries = max_entries;
+  g_ttl = ttl;
+  g_path = path ? strdup (path) : NULL;
+
+  if (g_path)
+    cache_load ();
+}
+
+char **
+cache_lookup (const char *query, int type, int offset, int *n_links)
+{
+  struct cache_entry *e = entry_find (query, type, offset);
+
+  if (e == NULL || entry_expired (e))
+    {
+      g_misses++;
+      return NULL;
+    }
+
+  g_hits++;
+  entry_unlink (e);
+  entry_push_front (e);
+
+  *n_links = e->n_links;
+  return e->links;
+}
+
+int
+cache_store (const char *query, int type, int offset, char **links,
+             int n_links)
+{
+  struct cache_entry *e = entry_find (query, type, offset);
+  int i;
+
+  if (e)
+    {
+      bool changed = e->n_links != n_links;
+      for (i = 0; !changed && i < n_links; i++)
+        changed = strcmp (e->links[i], links[i]) != 0;
+
+      e->stored = time (NULL);
+      entry_unlink (e);
+      entry_push_front (e);
+
+      if (!changed)
+        {
+          for (i = 0; i < n_links; i++)
+            free (links[i]);
+          free (links);
+          return 0;
+        }
+
+      for (i = 0; i < e->n_links; i++)
+        free (e->links[i]);
+      free (e->links);
+      e->links = links;
+      e->n_links = n_links;
+    }
+  else
+    entry_add (query, type, offset, time (NULL), links, n_links, false);
+
+  return 1;
+}
+
+void
+cache_stats (unsigned long *hits, unsigned long *misses)
+{
+  *hits = g_hits;
+  *misses = g_misses;
+}
@@ -0,0 +1,275 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shpotify.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* The rows of the playlists screen, one per entry of the session
+   playlist container, kept up to date by the container callbacks
+   instead of being built again every time they are shown.  */
+
+static sp_playlistcontainer *g_container;
+static struct search_result *g_rows;
+/* Folder nesting of every row.  */
+static unsigned char *g_levels;
+static int g_n_rows;
+static int g_allocated;
+static bool g_loaded;
+static unsigned long g_generation;
+
+static void
+row_read (struct search_result *sr, int i)
+{
+  memset (sr, 0, sizeof *sr);
+
+  switch (sp_playlistcontainer_playlist_type (g_container, i))
+    {
+    case SP_PLAYLIST_TYPE_PLAYLIST:
+      sr->playlist = sp_playlistcontainer_playlist (g_container, i);
+      if (sr->playlist == NULL)
+        break;
+      sp_playlist_add_ref (sr->playlist);
+      sr->type = TYPE_PLAYLIST;
+      return;
+
+    case SP_PLAYLIST_TYPE_START_FOLDER:
+      sp_playlistcontainer_playlist_folder_name (g_container, i, sr->folder,
+                                                 sizeof sr->folder);
+      sr->type = TYPE_PLAYLISTCONTAINER_START;
+      return;
+
+    case SP_PLAYLIST_TYPE_END_FOLDER:
+      sr->type = TYPE_PLAYLISTCONTAINER_END;
+      return;
+
+    default:
+      break;
+    }
+
+  /* Keep one row per entry, so that the rows and the entries have the
+     same index.  It shows as loading.  */
+  sr->link = "";
+  sr->type = TYPE_LINK;
+}
+
+static void
+levels_update (int from)
+{
+  int i;
+
+  for (i = max (from, 0); i < g_n_rows; i++)
+    {
+      int level = 0;
+      if (i > 0)
+        level = g_levels[i - 1]
+          + (g_rows[i - 1].type == TYPE_PLAYLISTCONTAINER_START ? 1 : 0)
+          + (g_rows[i - 1].type == TYPE_PLAYLISTCONTAINER_END ? -1 : 0);
+      g_levels[i] = min (max (level, 0), 255);
+    }
+}
+
+static int
+rows_reserve (int n)
+{
+  struct search_result *rows;
+  unsigned char *levels;
+  int allocated = max (g_allocated, 16);
+
+  if (n < g_allocated)
+    return 0;
+
+  while (allocated <= n)
+    allocated *= 2;
+
+  rows = realloc (g_rows, (allocated + 1) * sizeof *rows);
+  if (rows == NULL)
+    return -1;
+  g_rows = rows;
+
+  levels = realloc (g_levels, allocated + 1);
+  if (levels == NULL)
+    return -1;
+  g_levels = levels;
+
+  g_allocated = allocated;
+  return 0;
+}
+
+static void
+rows_free ()
+{
+  free_search_results (g_rows);
+  free (g_rows);
+  free (g_levels);
+  g_rows = NULL;
+  g_levels = NULL;
+  g_n_rows = 0;
+  g_allocated = 0;
+  g_loaded = false;
+  g_generation++;
+}
+
+static void
+rebuild ()
+{
+  int i, n = sp_playlistcontainer_num_playlists (g_container);
+
+  rows_free ();
+  if (rows_reserve (n) < 0)
+    return;
+
+  for (i = 0; i < n; i++)
+    row_read (&g_rows[i], i);
+  g_rows[n].type = TYPE_LAST;
+  g_n_rows = n;
+
+  levels_update (0);
+  g_loaded = true;
+}
+
+static void
+playlist_added (sp_playlistcontainer *pc, sp_playlist *playlist,
+                int position, void *userdata)
+{
+  if (!g_loaded || position < 0 || position > g_n_rows
+      || rows_reserve (g_n_rows + 1) < 0)
+    return;
+
+  memmove (&g_rows[position + 1], &g_rows[position],
+           (g_n_rows - position + 1) * sizeof *g_rows);
+  g_n_rows++;
+  row_read (&g_rows[position], position);
+
+  levels_update (position);
+  g_generation++;
+}
+
+static void
+playlist_removed (sp_playlistcontainer *pc, sp_playlist *playlist,
+                  int position, void *userdata)
+{
+  if (!g_loaded || position < 0 || position >= g_n_rows)
+    return;
+
+  search_result_release (&g_rows[position]);
+  memmove (&g_rows[position], &g_rows[position + 1],
+           (g_n_rows - position) * sizeof *g_rows);
+  g_n_rows--;
+
+  levels_update (position);
+  g_generation++;
+}
+
+static void
+playlist_moved (sp_playlistcontainer *pc, sp_playlist *playlist,
+                int position, int new_position, void *userdata)
+{
+  int i, from = min (position, new_position);
+  int to = min (max (position, new_position), g_n_rows - 1);
+
+  if (!g_loaded || from < 0)
+    return;
+
+  /* Only the rows between the two positions changed, read them again
+     from the container.  */
+  for (i = from; i <= to; i++)
+    {
+      search_result_release (&g_rows[i]);
+      row_read (&g_rows[i], i);
+    }
+
+  levels_update (from);
+  g_generation++;
+}
+
+static void
+container_loaded (sp_playlistcontainer *pc, void *userdata)
+{
+  rebuild ();
+  g_generation++;
+}
+
+static sp_playlistcontainer_callbacks g_callbacks =
+  {
+    .playlist_added = playlist_added,
+    .playlist_removed = playlist_removed,
+    .playlist_moved = playlist_moved,
+    .container_loaded = container_loaded
+  };
+
+void
+container_start (sp_session *session)
+{
+  container_stop ();
+
+  g_container = sp_session_playlistcontainer (session);
+  if (g_container == NULL)
+    return;
+
+  sp_playlistcontainer_add_ref (g_container);
+  sp_playlistcontainer_add_callbacks (g_container, &g_callbacks, NULL);
+}
+
+void
+container_stop ()
+{
+  if (g_container)
+    {
+      sp_playlistcontainer_remove_callbacks (g_container, &g_callbacks, NULL);
+      sp_playlistcontainer_release (g_container);
+      g_container = NULL;
+    }
+
+  rows_free ();
+}
+
+struct search_result *
+container_rows ()
+{
+  /* The container may be loaded before its callback is called.  */
+  if (!g_loaded && g_container && sp_playlistcontainer_is_loaded (g_container))
+    {
+      rebuild ();
+      g_generation++;
+    }
+
+  return g_loaded ? g_rows : NULL;
+}
+
+const unsigned char *
+container_levels ()
+{
+  return g_loaded ? g_levels : NULL;
+}
+
+unsigned long
+container_generation ()
+{
+  return g_generation;
+}
@@ -0,0 +1,349 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#define _GNU_SOURCE
+
+#include "shpotify.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Control socket of the daemon.  Every client sends commands, one per
+   line, and gets one reply line per command in the same order, so many
+   commands can be sent without waiting for the replies.  The clients
+   that sent "subscribe" also get a line for every event.
+
+   A single poll serves the listening socket and all the clients; no
+   call blocks.  */
+
+struct client
+{
+  /* -1 for a free slot.  */
+  int fd;
+  bool subscribed;
+  bool closing;
+  char in[CONTROL_LINE_MAX];
+  size_t in_len;
+  char *out;
+  size_t out_len, out_allocated;
+};
+
+static int g_listen = -1;
+static char *g_path;
+static struct client g_clients[CONTROL_MAX_CLIENTS];
+static control_handler g_handler;
+
+static void
+client_close (struct client *c)
+{
+  close (c->fd);
+  free (c->out);
+  memset (c, 0, sizeof *c);
+  c->fd = -1;
+}
+
+/* Queue LEN bytes of DATA for C.  A client that does not read what it
+   is sent is dropped.  */
+static void
+client_send (struct client *c, const char *data, size_t len)
+{
+  if (c->out_len + len > CONTROL_OUT_MAX)
+    {
+      c->closing = true;
+      c->out_len = 0;
+      return;
+    }
+
+  if (c->out_len + len > c->out_allocated)
+    {
+      size_t n = max (c->out_allocated * 2, c->out_len + len);
+      char *out = realloc (c->out, n);
+      if (out == NULL)
+        return;
+      c->out = out;
+      c->out_allocated = n;
+    }
+
+  memcpy (c->out + c->out_len, data, len);
+  c->out_len += len;
+}
+
+static void
+client_flush (struct client *c)
+{
+  while (c->out_len)
+    {
+      /* A client gone away must not kill the daemon with SIGPIPE.  */
+      ssize_t n = send (c->fd, c->out, c->out_len, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+      if (n <= 0)
+        {
+          c->closing = true;
+          c->out_len = 0;
+          return;
+        }
+
+      memmove (c->out, c->out + n, c->out_len - n);
+      c->out_len -= n;
+    }
+}
+
+static void
+client_command (struct client *c, char *line)
+{
+  char reply[CONTROL_LINE_MAX];
+
+  if (strcmp (line, "subscribe") == 0)
+    {
+      c->subscribed = true;
+      strcpy (reply, "ok");
+    }
+  else if (strcmp (line, "quit") == 0)
+    {
+      c->closing = true;
+      strcpy (reply, "ok");
+    }
+  else
+    g_handler (line, reply, sizeof reply - 1);
+
+  client_send (c, reply, strlen (reply));
+  client_send (c, "\n", 1);
+}
+
+/* Run the complete lines received from C.  */
+static void
+client_read (struct client *c)
+{
+  char *line, *end;
+  ssize_t n;
+
+  n = read (c->fd, c->in + c->in_len, sizeof c->in - c->in_len);
+  if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+    return;
+  if (n <= 0)
+    {
+      c->closing = true;
+      return;
+    }
+  c->in_len += n;
+
+  /* Nothing runs after a "quit" of the client, even in the same
+     read.  */
+  for (line = c->in;
+       !c->closing
+       && (end = memchr (line, '\n', c->in + c->in_len - line));
+       line = end + 1)
+    {
+      *end = '\0';
+      if (end > line && end[-1] == '\r')
+        end[-1] = '\0';
+      if (line[0])
+        client_command (c, line);
+    }
+
+  c->in_len -= line - c->in;
+  memmove (c->in, line, c->in_len);
+
+  if (c->in_len == sizeof c->in)
+    {
+      static const char error[] = "error line too long\n";
+      client_send (c, error, sizeof error - 1);
+      c->in_len = 0;
+    }
+}
+
+static void
+accept_clients ()
+{
+  int fd, i;
+
+  while ((fd = accept4 (g_listen, NULL, NULL,
+                        SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+      for (i = 0; i < CONTROL_MAX_CLIENTS && g_clients[i].fd >= 0; i++)
+        ;
+      if (i == CONTROL_MAX_CLIENTS)
+        {
+          close (fd);
+          continue;
+        }
+
+      memset (&g_clients[i], 0, sizeof g_clients[i]);
+      g_clients[i].fd = fd;
+    }
+}
+
+int
+control_start (const char *path, control_handler handler)
+{
+  struct sockaddr_un addr;
+  int fd, i, error;
+
+  if (strlen (path) >= sizeof addr.sun_path)
+    return -1;
+
+  memset (&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, path);
+
+  fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  /* A socket nobody listens on was left by a daemon that died.  Any
+     other failure, as EAGAIN from a daemon with a full backlog, means
+     the socket may still be in use.  */
+  if (connect (fd, (struct sockaddr *) &addr, sizeof addr) == 0)
+    error = EADDRINUSE;
+  else if (errno == ECONNREFUSED || errno == ENOENT)
+    {
+      error = 0;
+      if (errno == ECONNREFUSED)
+        unlink (path);
+    }
+  else
+    error = errno == EAGAIN || errno == EINPROGRESS ? EADDRINUSE : errno;
+  close (fd);
+  if (error)
+    {
+      errno = error;
+      return -1;
+    }
+
+  fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  if (bind (fd, (struct sockaddr *) &addr, sizeof addr) < 0
+      || listen (fd, CONTROL_MAX_CLIENTS) < 0)
+    {
+      close (fd);
+      return -1;
+    }
+
+  for (i = 0; i < CONTROL_MAX_CLIENTS; i++)
+    g_clients[i].fd = -1;
+
+  g_listen = fd;
+  g_path = strdup (path);
+  g_handler = handler;
+  return 0;
+}
+
+void
+control_stop ()
+{
+  int i;
+
+  if (g_listen < 0)
+    return;
+
+  for (i = 0; i < CONTROL_MAX_CLIENTS; i++)
+    if (g_clients[i].fd >= 0)
+      client_close (&g_clients[i]);
+
+  close (g_listen);
+  g_listen = -1;
+  unlink (g_path);
+  free (g_path);
+  g_path = NULL;
+}
+
+void
+control_poll (int timeout)
+{
+  struct pollfd fds[CONTROL_MAX_CLIENTS + 1];
+  struct client *clients[CONTROL_MAX_CLIENTS + 1];
+  int i, n = 1;
+
+  if (g_listen < 0)
+    return;
+
+  fds[0].fd = g_listen;
+  fds[0].events = POLLIN;
+  for (i = 0; i < CONTROL_MAX_CLIENTS; i++)
+    {
+      struct client *c = &g_clients[i];
+
+      if (c->fd < 0)
+        continue;
+
+      fds[n].fd = c->fd;
+      fds[n].events = POLLIN | (c->out_len ? POLLOUT : 0);
+      clients[n++] = c;
+    }
+
+  if (poll (fds, n, timeout) <= 0)
+    return;
+
+  for (i = 1; i < n; i++)
+    {
+      struct client *c = clients[i];
+
+      if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+        client_read (c);
+      client_flush (c);
+      if (c->closing && c->out_len == 0)
+        client_close (c);
+    }
+
+  if (fds[0].revents & POLLIN)
+    accept_clients ();
+}
+
+void
+control_event (const char *fmt, ...)
+{
+  char buffer[CONTROL_LINE_MAX];
+  va_list ap;
+  int i, len;
+
+  if (g_listen < 0)
+    return;
+
+  strcpy (buffer, "event ");
+  va_start (ap, fmt);
+  len = vsnprintf (buffer + 6, sizeof buffer - 7, fmt, ap);
+  va_end (ap);
+  if (len < 0)
+    return;
+  len = min (len + 6, (int) sizeof buffer - 2);
+  buffer[len++] = '\n';
+
+  for (i = 0; i < CONTROL_MAX_CLIENTS; i++)
+    if (g_clients[i].fd >= 0 && g_clients[i].subscribed)
+      client_send (&g_clients[i], buffer, len);
+}
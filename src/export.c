@@ -0,0 +1,440 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shpotify.h"
+
+#include <string.h>
+
+/* Export of the starred tracks and of every playlist of the container,
+   written as soon as each playlist and the metadata of its tracks are
+   loaded.  Up to EXPORT_PARALLEL playlists load at once; nothing else
+   is kept in memory, so the order of the output is the order in which
+   they finish loading.  Every playlist carries the path of the folders
+   it is in.  */
+
+enum
+  {
+    SLOT_FREE,
+    SLOT_LOADING,
+    /* The playlist is loaded, the metadata of its tracks is not.  */
+    SLOT_TRACKS
+  };
+
+struct export_slot
+{
+  int state;
+  sp_playlist *playlist;
+  struct load_request *req;
+  long long deadline;
+  /* The tracks before this one are loaded.  */
+  int checked;
+  char folder[EXPORT_FOLDER_MAX];
+};
+
+static sp_session *g_session;
+static FILE *g_out;
+static int g_format;
+static bool g_started;
+static sp_playlist *g_starred;
+static struct export_slot g_slots[EXPORT_PARALLEL];
+/* Next row of the container to export, -1 is the starred playlist.  */
+static int g_next;
+static bool g_walked;
+static unsigned long g_generation;
+/* The last playlist of the container handed to a slot, to find where
+   to go on when the container changes.  */
+static sp_playlist *g_last;
+/* Folders of the row G_NEXT.  */
+static char g_folder[EXPORT_FOLDER_MAX];
+static int g_exported, g_failed;
+
+static void
+json_string (const char *s)
+{
+  putc ('"', g_out);
+  for (; *s; s++)
+    {
+      unsigned char c = *s;
+      if (c == '"' || c == '\\')
+        fprintf (g_out, "\\%c", c);
+      else if (c < 0x20)
+        fprintf (g_out, "\\u%04x", c);
+      else
+        putc (c, g_out);
+    }
+  putc ('"', g_out);
+}
+
+static void
+csv_field (const char *s, bool last)
+{
+  if (strpbrk (s, ",\"\r\n"))
+    {
+      putc ('"', g_out);
+      for (; *s; s++)
+        {
+          if (*s == '"')
+            putc ('"', g_out);
+          putc (*s, g_out);
+        }
+      putc ('"', g_out);
+    }
+  else
+    fputs (s, g_out);
+  putc (last ? '\n' : ',', g_out);
+}
+
+static const char *
+playlist_link (sp_playlist *pl, char *buffer, int len)
+{
+  struct search_result sr;
+
+  sr.type = TYPE_PLAYLIST;
+  sr.playlist = pl;
+  return search_result_link (&sr, buffer, len) == 0 ? buffer : "";
+}
+
+static const char *
+track_link (sp_track *track, char *buffer, int len)
+{
+  struct search_result sr;
+
+  sr.type = TYPE_TRACK;
+  sr.track = track;
+  return search_result_link (&sr, buffer, len) == 0 ? buffer : "";
+}
+
+static bool
+track_loaded (sp_track *track)
+{
+  sp_album *album;
+
+  if (!sp_track_is_loaded (track))
+    return false;
+
+  album = sp_track_album (track);
+  return (album == NULL || sp_album_is_loaded (album))
+    && (sp_track_num_artists (track) == 0
+        || sp_artist_is_loaded (sp_track_artist (track, 0)));
+}
+
+static void
+write_track (sp_playlist *pl, const char *pl_link, const char *pl_name,
+             const char *folder, int i)
+{
+  sp_track *track = sp_playlist_track (pl, i);
+  const char *name = "", *artist = "", *album = "";
+  char link[256], position[16], duration[16];
+
+  if (track_loaded (track))
+    {
+      name = sp_track_name (track);
+      if (sp_track_num_artists (track))
+        artist = sp_artist_name (sp_track_artist (track, 0));
+      if (sp_track_album (track))
+        album = sp_album_name (sp_track_album (track));
+    }
+  track_link (track, link, sizeof link);
+  snprintf (position, sizeof position, "%d", i);
+  snprintf (duration, sizeof duration, "%d",
+            sp_track_is_loaded (track) ? sp_track_duration (track) : 0);
+
+  if (g_format == EXPORT_CSV)
+    {
+      csv_field (pl_link, false);
+      csv_field (pl_name, false);
+      csv_field (folder, false);
+      csv_field (position, false);
+      csv_field (link, false);
+      csv_field (name, false);
+      csv_field (artist, false);
+      csv_field (album, false);
+      csv_field (duration, true);
+      return;
+    }
+
+  fputs ("{\"type\":\"track\",\"playlist\":", g_out);
+  json_string (pl_link);
+  fprintf (g_out, ",\"position\":%s,\"link\":", position);
+  json_string (link);
+  fputs (",\"name\":", g_out);
+  json_string (name);
+  fputs (",\"artist\":", g_out);
+  json_string (artist);
+  fputs (",\"album\":", g_out);
+  json_string (album);
+  fprintf (g_out, ",\"duration_ms\":%s}\n", duration);
+}
+
+static void
+write_playlist (struct export_slot *slot)
+{
+  sp_playlist *pl = slot->playlist;
+  const char *name = pl == g_starred ? "Starred" : sp_playlist_name (pl);
+  int i, n = sp_playlist_num_tracks (pl);
+  char link[256];
+
+  playlist_link (pl, link, sizeof link);
+  if (g_format == EXPORT_JSONL)
+    {
+      fputs ("{\"type\":\"playlist\",\"link\":", g_out);
+      json_string (link);
+      fputs (",\"name\":", g_out);
+      json_string (name);
+      fputs (",\"folder\":", g_out);
+      json_string (slot->folder);
+      fprintf (g_out, ",\"tracks\":%d}\n", n);
+    }
+
+  for (i = 0; i < n; i++)
+    write_track (pl, link, name, slot->folder, i);
+
+  fflush (g_out);
+  g_exported++;
+}
+
+static void
+slot_free (struct export_slot *slot)
+{
+  if (slot->req)
+    load_cancel (slot->req);
+  sp_playlist_release (slot->playlist);
+  memset (slot, 0, sizeof *slot);
+}
+
+static void
+playlist_loaded (void *object, sp_error error, void *data)
+{
+  struct export_slot *slot = data;
+  char link[256];
+
+  slot->req = NULL;
+  if (error != SP_ERROR_OK)
+    {
+      fprintf (stderr, "Cannot load %s: %s\n",
+               playlist_link (slot->playlist, link, sizeof link),
+               error == LOAD_ERROR_TIMEOUT ? "timed out"
+               : sp_error_message (error));
+      g_failed++;
+      slot_free (slot);
+      return;
+    }
+
+  slot->state = SLOT_TRACKS;
+  slot->deadline = now_ms () + EXPORT_TRACKS_TIMEOUT_MS;
+}
+
+static void
+dispatch (struct export_slot *slot, sp_playlist *pl)
+{
+  slot->state = SLOT_LOADING;
+  slot->playlist = pl;
+  sp_playlist_add_ref (pl);
+  snprintf (slot->folder, sizeof slot->folder, "%s", g_folder);
+  slot->req = load_playlist (pl, TIMEOUT * 1000, playlist_loaded, slot);
+  if (slot->req == NULL)
+    {
+      g_failed++;
+      slot_free (slot);
+    }
+}
+
+/* Follow the folders in G_FOLDER as row SR is walked.  */
+static void
+folder_row (struct search_result *sr)
+{
+  size_t len = strlen (g_folder);
+
+  if (sr->type == TYPE_PLAYLISTCONTAINER_START)
+    snprintf (g_folder + len, sizeof g_folder - len, "%s%s",
+              len ? "/" : "", sr->folder);
+  else if (sr->type == TYPE_PLAYLISTCONTAINER_END)
+    {
+      char *slash = strrchr (g_folder, '/');
+      *(slash ? slash : g_folder) = '\0';
+    }
+}
+
+/* The container changed while it was exported: go on after the last
+   playlist handed out, wherever it is now, in the folders it is now
+   in.  When that playlist was removed there is no telling which rows
+   were exported, the walk goes on from the same index and warns that
+   playlists may be missing or repeated.  */
+static void
+relocate (struct search_result *rows)
+{
+  int i;
+
+  if (g_next <= 0)
+    return;
+
+  for (i = 0; rows[i].type; i++)
+    if (g_last && rows[i].type == TYPE_PLAYLIST && rows[i].playlist == g_last)
+      break;
+
+  if (rows[i].type)
+    g_next = i + 1;
+  else
+    {
+      if (g_last)
+        fprintf (stderr, "The playlists changed during the export, some "
+                 "may be missing or repeated.\n");
+      g_next = min (g_next, i);
+    }
+
+  g_folder[0] = '\0';
+  for (i = 0; i < g_next; i++)
+    folder_row (&rows[i]);
+}
+
+/* Start loading the next playlists, while there are free slots.  */
+static void
+walk ()
+{
+  struct search_result *rows = container_rows ();
+  int i;
+
+  if (g_generation != container_generation ())
+    {
+      relocate (rows);
+      g_generation = container_generation ();
+    }
+
+  for (i = 0; i < EXPORT_PARALLEL && !g_walked; i++)
+    {
+      struct search_result *sr;
+
+      if (g_slots[i].state != SLOT_FREE)
+        continue;
+
+      for (; g_next < 0 || rows[g_next].type; g_next++)
+        {
+          if (g_next < 0)
+            {
+              dispatch (&g_slots[i], g_starred);
+              g_next++;
+              break;
+            }
+
+          sr = &rows[g_next];
+          folder_row (sr);
+          if (sr->type == TYPE_PLAYLISTCONTAINER_START
+              && g_format == EXPORT_JSONL)
+            {
+              fputs ("{\"type\":\"folder\",\"path\":", g_out);
+              json_string (g_folder);
+              fputs ("}\n", g_out);
+            }
+          else if (sr->type == TYPE_PLAYLIST)
+            {
+              dispatch (&g_slots[i], sr->playlist);
+              if (g_last)
+                sp_playlist_release (g_last);
+              g_last = sr->playlist;
+              sp_playlist_add_ref (g_last);
+              g_next++;
+              break;
+            }
+        }
+
+      if (g_next >= 0 && rows[g_next].type == TYPE_LAST)
+        g_walked = true;
+    }
+}
+
+void
+export_start (sp_session *session, FILE *out, int format)
+{
+  g_session = session;
+  g_out = out;
+  g_format = format;
+  g_starred = sp_session_starred_create (session);
+  g_next = g_starred ? -1 : 0;
+  g_generation = container_generation ();
+  g_started = true;
+
+  if (format == EXPORT_CSV)
+    fputs ("playlist_link,playlist,folder,position,link,name,artist,album,"
+           "duration_ms\n", g_out);
+}
+
+bool
+export_process ()
+{
+  struct search_result *rows;
+  bool busy = false;
+  int i;
+
+  if (!g_started)
+    return false;
+
+  /* The container model is filled once the container is loaded.  */
+  rows = container_rows ();
+  if (rows == NULL)
+    return false;
+
+  walk ();
+
+  for (i = 0; i < EXPORT_PARALLEL; i++)
+    {
+      struct export_slot *slot = &g_slots[i];
+      int n;
+
+      if (slot->state == SLOT_FREE)
+        continue;
+      busy = true;
+      if (slot->state != SLOT_TRACKS)
+        continue;
+
+      n = sp_playlist_num_tracks (slot->playlist);
+      while (slot->checked < n
+             && track_loaded (sp_playlist_track (slot->playlist,
+                                                 slot->checked)))
+        slot->checked++;
+
+      /* The tracks still missing their metadata are written with only
+         their link.  */
+      if (slot->checked == n || now_ms () > slot->deadline)
+        {
+          write_playlist (slot);
+          slot_free (slot);
+        }
+    }
+
+  if (busy || !g_walked)
+    return false;
+
+  if (g_starred)
+    sp_playlist_release (g_starred);
+  g_starred = NULL;
+  if (g_last)
+    sp_playlist_release (g_last);
+  g_last = NULL;
+  g_started = false;
+  fprintf (stderr, "%d playlists exported, %d failed\n", g_exported, g_failed);
+  return true;
+}
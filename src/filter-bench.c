@@ -0,0 +1,90 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shpotify.h"
+
+#include <time.h>
+
+/* Time the list filter on BENCH_ROWS made up names, as the query is
+   typed one key at a time.  Build it with "make filter-bench".  */
+
+#define BENCH_ROWS 100000
+
+static const char *const g_words[] =
+  {
+    "love", "night", "blue", "heart", "dance", "river", "fire", "dream",
+    "road", "summer", "light", "home", "rain", "gold", "moon", "wild"
+  };
+
+static double
+now_us ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int
+main ()
+{
+  static const char *const queries[] =
+    {
+      "r", "ri", "riv", "rive", "river", "river ", "river n", "river ni",
+      "xq", "rvr"
+    };
+  static char names_text[BENCH_ROWS][64];
+  static const char *names[BENCH_ROWS];
+  struct filter f;
+  unsigned seed = 1;
+  double start;
+  size_t i, n;
+
+  for (i = 0; i < BENCH_ROWS; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      snprintf (names_text[i], sizeof names_text[i], "%s %s %zu",
+                g_words[(seed >> 8) % 16], g_words[(seed >> 16) % 16], i);
+      names[i] = names_text[i];
+    }
+
+  start = now_us ();
+  if (filter_init (&f, names, BENCH_ROWS) < 0)
+    return 1;
+  printf ("filter_init %d rows: %.2f ms\n", BENCH_ROWS,
+          (now_us () - start) / 1000);
+
+  for (i = 0; i < sizeof queries / sizeof *queries; i++)
+    {
+      start = now_us ();
+      n = filter_apply (&f, queries[i]);
+      printf ("filter_apply \"%s\": %.2f ms, %zu rows\n", queries[i],
+              (now_us () - start) / 1000, n);
+    }
+
+  filter_free (&f);
+  return 0;
+}
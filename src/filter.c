@@ -0,0 +1,181 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shpotify.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+/* Filter of the rows of a list by their name.  The names are copied
+   lowercased one after the other, so matching a query is a scan of a
+   single buffer.  A row whose name contains the query scores better
+   than one that only has its letters in order.  */
+
+#define SCORE_SUBSTRING 2000
+#define SCORE_WORD_START 500
+#define SCORE_SUBSEQUENCE 1000
+#define SCORE_MAX (SCORE_SUBSTRING + SCORE_WORD_START)
+
+static char
+lower (char c)
+{
+  return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+/* First C in [S, END), or END.  */
+static const char *
+find_byte (const char *s, const char *end, char c)
+{
+#ifdef __SSE2__
+  __m128i needle = _mm_set1_epi8 (c);
+
+  for (; end - s >= 16; s += 16)
+    {
+      __m128i chunk = _mm_loadu_si128 ((const __m128i *) s);
+      int mask = _mm_movemask_epi8 (_mm_cmpeq_epi8 (chunk, needle));
+      if (mask)
+        return s + __builtin_ctz (mask);
+    }
+#endif
+
+  for (; s < end; s++)
+    if (*s == c)
+      return s;
+
+  return end;
+}
+
+/* Score of the name in [S, END) for the lowercased query Q, 0 if it
+   does not match.  */
+static int
+score (const char *s, const char *end, const char *q, size_t len)
+{
+  const char *p, *first;
+  size_t i;
+
+  for (p = s; (p = find_byte (p, end, q[0])) < end && (size_t) (end - p) >= len;
+       p++)
+    if (memcmp (p, q, len) == 0)
+      return SCORE_SUBSTRING - min (p - s, SCORE_WORD_START - 1)
+        + (p == s || p[-1] == ' ' ? SCORE_WORD_START : 0);
+
+  first = p = find_byte (s, end, q[0]);
+  for (i = 1; p < end && i < len; i++)
+    p = find_byte (p + 1, end, q[i]);
+
+  if (p == end)
+    return 0;
+
+  /* The fewer letters between the first and the last, the better.  */
+  return max (SCORE_SUBSEQUENCE - (int) (p - first + 1 - len), 1);
+}
+
+int
+filter_init (struct filter *f, const char *const *names, size_t n)
+{
+  size_t i, size = 0;
+  char *t;
+
+  memset (f, 0, sizeof *f);
+  for (i = 0; i < n; i++)
+    size += strlen (names[i]);
+
+  f->text = malloc (size + 1);
+  f->offsets = malloc ((n + 1) * sizeof *f->offsets);
+  f->rows = malloc (n * sizeof *f->rows + 1);
+  f->scores = malloc (n * sizeof *f->scores + 1);
+  if (f->text == NULL || f->offsets == NULL || f->rows == NULL
+      || f->scores == NULL)
+    {
+      filter_free (f);
+      return -1;
+    }
+
+  for (i = 0, t = f->text; i < n; i++)
+    {
+      const char *s;
+
+      f->offsets[i] = t - f->text;
+      for (s = names[i]; *s; s++)
+        *t++ = lower (*s);
+    }
+  f->offsets[n] = t - f->text;
+  f->n = n;
+  return 0;
+}
+
+size_t
+filter_apply (struct filter *f, const char *query)
+{
+  size_t i, len = strlen (query), *counts;
+  char q[64];
+
+  for (i = 0; i < len && i < sizeof q - 1; i++)
+    q[i] = lower (query[i]);
+  q[i] = '\0';
+  len = i;
+
+  for (i = 0; i < f->n; i++)
+    f->scores[i] = len == 0 ? 1 : score (f->text + f->offsets[i],
+                                         f->text + f->offsets[i + 1], q, len);
+
+  /* The scores are small, a counting sort keeps the rows with the same
+     score in their order.  */
+  counts = calloc (SCORE_MAX + 2, sizeof *counts);
+  if (counts == NULL)
+    {
+      f->n_rows = 0;
+      return 0;
+    }
+
+  for (i = 0; i < f->n; i++)
+    if (f->scores[i])
+      counts[SCORE_MAX - f->scores[i] + 1]++;
+  for (i = 1; i <= SCORE_MAX + 1; i++)
+    counts[i] += counts[i - 1];
+
+  f->n_rows = counts[SCORE_MAX + 1];
+  for (i = 0; i < f->n; i++)
+    if (f->scores[i])
+      f->rows[counts[SCORE_MAX - f->scores[i]]++] = i;
+
+  free (counts);
+  return f->n_rows;
+}
+
+void
+filter_free (struct filter *f)
+{
+  free (f->text);
+  free (f->offsets);
+  free (f->rows);
+  free (f->scores);
+  memset (f, 0, sizeof *f);
+}
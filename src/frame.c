@@ -0,0 +1,241 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#define _GNU_SOURCE
+
+#include "shpotify.h"
+
+#include <curses.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Everything is drawn to stdscr and sent to the terminal here, at most
+   FRAME_RATE_MAX times per second.  ncurses keeps track of the lines
+   touched since the last frame, so a frame costs nothing when nothing
+   was drawn.
+
+   In the low-bandwidth mode the frames are fewer, and a frame bigger
+   than FRAME_BYTES_LOW delays the next one as if it was several
+   frames, so that the output is spread over time.  */
+
+static WINDOW *g_input_wnd;
+static long long g_last_frame;
+static bool g_damaged;
+static bool g_low_bandwidth;
+/* Bytes of the frames sent to the terminal, and the count at the last
+   frame.  */
+static unsigned long long g_tty_bytes;
+static unsigned long long g_frame_start_bytes;
+/* Frames the last one was worth, with respect to the byte budget.  */
+static int g_frame_cost = 1;
+
+/* The terminal descriptor given to ncurses, another one on the
+   terminal, and the file a frame is written to before it is sent.
+   ncurses writes to its descriptor directly, the frames are counted by
+   pointing it to g_frame_fd while doupdate runs; termios and the
+   window size keep working on the terminal.  */
+static int g_tty_fd = -1;
+static int g_tty_save = -1;
+static int g_frame_fd = -1;
+
+static void
+tty_write (const char *buf, size_t size)
+{
+  size_t done = 0;
+
+  while (done < size)
+    {
+      ssize_t r = write (g_tty_fd, buf + done, size - done);
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r < 0)
+        break;
+      done += r;
+    }
+
+  g_tty_bytes += done;
+}
+
+/* The terminal output for newterm.  */
+FILE *
+frame_tty ()
+{
+  int fd = dup (STDOUT_FILENO);
+  FILE *tty;
+
+  if (fd < 0)
+    return NULL;
+
+  tty = fdopen (fd, "w");
+  if (tty == NULL)
+    {
+      close (fd);
+      return NULL;
+    }
+
+  /* Without them the frames are sent but not counted.  */
+  g_tty_fd = fd;
+  g_tty_save = fcntl (fd, F_DUPFD_CLOEXEC, 0);
+  g_frame_fd = memfd_create ("frame", MFD_CLOEXEC);
+  if (g_tty_save < 0 || g_frame_fd < 0)
+    {
+      if (g_tty_save >= 0)
+        close (g_tty_save);
+      if (g_frame_fd >= 0)
+        close (g_frame_fd);
+      g_tty_save = g_frame_fd = -1;
+    }
+
+  return tty;
+}
+
+/* Send to the terminal what doupdate wrote in g_frame_fd.  */
+static void
+frame_send ()
+{
+  char buffer[BUFSIZ];
+  off_t offset = 0;
+  ssize_t n;
+
+  while ((n = pread (g_frame_fd, buffer, sizeof buffer, offset)) > 0)
+    {
+      tty_write (buffer, n);
+      offset += n;
+    }
+
+  if (ftruncate (g_frame_fd, 0) < 0)
+    return;
+  lseek (g_frame_fd, 0, SEEK_SET);
+}
+
+static void
+frame_update ()
+{
+  /* After endwin, doupdate sets the terminal modes again on its
+     descriptor.  */
+  if (g_frame_fd < 0 || isendwin () || dup2 (g_frame_fd, g_tty_fd) < 0)
+    {
+      doupdate ();
+      return;
+    }
+
+  doupdate ();
+  dup2 (g_tty_save, g_tty_fd);
+  frame_send ();
+}
+
+unsigned long long
+frame_tty_bytes ()
+{
+  return g_tty_bytes;
+}
+
+void
+frame_set_low_bandwidth (bool low)
+{
+  g_low_bandwidth = low;
+}
+
+bool
+frame_low_bandwidth ()
+{
+  return g_low_bandwidth;
+}
+
+/* Bytes a frame may send in the low-bandwidth mode, 0 if unlimited.  */
+int
+frame_budget ()
+{
+  return g_low_bandwidth ? FRAME_BYTES_LOW : 0;
+}
+
+static int
+frame_interval ()
+{
+  return 1000 / (g_low_bandwidth ? FRAME_RATE_LOW : FRAME_RATE_MAX);
+}
+
+void
+frame_init ()
+{
+  if (g_input_wnd == NULL)
+    {
+      /* wgetch refreshes the window it reads from when it was touched,
+         a window nothing is drawn to keeps the refresh here.  */
+      g_input_wnd = newwin (1, 1, 0, 0);
+      untouchwin (g_input_wnd);
+    }
+
+  keypad (g_input_wnd, TRUE);
+  g_damaged = true;
+}
+
+void
+frame_damage ()
+{
+  g_damaged = true;
+}
+
+int
+frame_flush ()
+{
+  long long now, start;
+
+  if (!g_damaged && !is_wintouched (stdscr))
+    return 0;
+
+  now = now_ms ();
+  if (now - g_last_frame < frame_interval () * g_frame_cost)
+    return frame_interval () * g_frame_cost - (now - g_last_frame);
+
+  g_frame_start_bytes = g_tty_bytes;
+  start = metrics_start ();
+  wnoutrefresh (stdscr);
+  frame_update ();
+  metrics_stop (METRIC_RENDER, start);
+  g_last_frame = now;
+  g_damaged = false;
+
+  g_frame_cost = 1;
+  if (frame_budget ())
+    g_frame_cost += (g_tty_bytes - g_frame_start_bytes) / frame_budget ();
+  return 0;
+}
+
+int
+frame_getch (int timeout_ms)
+{
+  int wait = frame_flush ();
+
+  if (wait)
+    timeout_ms = min (timeout_ms, wait);
+
+  wtimeout (g_input_wnd, timeout_ms);
+  return wgetch (g_input_wnd);
+}
@@ -214,13 +214,15 @@ img_scaling (const unsigned char *img, unsigned char *scaled_img, int w, int h,
 #undef CLAMP
 
 int
-img_show_art (FILE *infile)
+img_show_art (FILE *infile, int max_cells)
 {
   int i, j, s_h, s_w, c;
   int w, h, components, ret = 0;
   unsigned char *img, *scaled_img;
+  long long start = metrics_start (), span = trace_begin ();
 
   img = read_jpeg_file (infile, &w, &h, &components);
+  trace_end ("jpeg decode", span);
   if (img == NULL)
     return -1;
 
@@ -229,6 +231,17 @@ img_show_art (FILE *infile)
   s_w = min (g_w, w) - 2;
   s_h = min (g_h, h) - 2;
 
+  /* Shrink the picture until it fits in MAX_CELLS, and give up when
+     what is left is too small to be worth it.  */
+  while (max_cells > 0 && s_w * s_h > max_cells)
+    {
+      s_w = s_w * 3 / 4;
+      s_h = s_h * 3 / 4;
+    }
+
+  if (s_w < IMG_MIN_SIZE || s_h < IMG_MIN_SIZE / 2)
+    goto exit_img;
+
   scaled_img = malloc (s_h * s_w * components);
   if (scaled_img == NULL)
     {
@@ -236,8 +249,13 @@ img_show_art (FILE *infile)
       goto exit_img;
     }
 
+  span = trace_begin ();
   img_scaling (img, scaled_img, w, h, components, s_w, s_h);
+  trace_end ("art scaling", span);
+  span = trace_begin ();
   img_dithering (scaled_img, s_w, s_h, components);
+  trace_end ("art dithering", span);
+  span = trace_begin ();
   for (i = 0; i < s_w; i++)
     for (j = 0; j < s_h; j++)
       {
@@ -251,8 +269,10 @@ img_show_art (FILE *infile)
         color_set (palette_col + COLOR_MAX, NULL);
 	mvprintw (j + 1, i + offset, " ");
       }
+  trace_end ("art drawing", span);
   free(scaled_img);
 exit_img:
   free (img);
+  metrics_stop (METRIC_COVER_DECODE, start);
   return ret;
 }
@@ -0,0 +1,308 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shpotify.h"
+#include "queue.h"
+
+#include <ctype.h>
+#include <string.h>
+
+/* Import of a file of track links into a playlist or the play queue.
+   The file is read a few lines at a time, and at most
+   IMPORT_MAX_PENDING tracks are waiting for their metadata at once.
+   The tracks are taken in the order of the file once they are loaded,
+   and added IMPORT_BATCH at a time.  The links that cannot be added are
+   written, with their line, to IMPORT_LOG.  */
+
+struct import_item
+{
+  sp_track *track;
+  int line;
+  long long since;
+  char link[IMPORT_LINK_MAX];
+};
+
+enum
+  {
+    IMPORT_IDLE,
+    IMPORT_RUNNING,
+    /* The summary was not reported yet.  */
+    IMPORT_DONE
+  };
+
+static int g_state = IMPORT_IDLE;
+static sp_session *g_session;
+static FILE *g_in, *g_log;
+static sp_playlist *g_playlist;
+static queue_t *g_queue;
+static int g_line, g_added, g_failed;
+
+/* Tracks waiting for their metadata, in the order of the file.  */
+static struct import_item g_window[IMPORT_MAX_PENDING];
+static int g_head, g_count;
+
+static sp_track *g_batch[IMPORT_BATCH];
+static int g_n_batch;
+
+static void
+fail (int line, const char *link, const char *reason)
+{
+  g_failed++;
+  if (g_log)
+    fprintf (g_log, "%d: %s: %s\n", line, link, reason);
+}
+
+static void
+fail_batch (const char *reason)
+{
+  g_failed += g_n_batch;
+  if (g_log)
+    fprintf (g_log, "%d tracks not added: %s\n", g_n_batch, reason);
+}
+
+/* Turn a http://open.spotify.com/track/ID URL into a spotify:track:ID
+   link.  */
+static void
+url_to_link (char *s, size_t len)
+{
+  static const char *const prefixes[] =
+    { "https://open.spotify.com/", "http://open.spotify.com/" };
+  char buffer[IMPORT_LINK_MAX];
+  size_t i;
+
+  for (i = 0; i < sizeof prefixes / sizeof prefixes[0]; i++)
+    {
+      const char *rest;
+      char *p;
+
+      if (strncmp (s, prefixes[i], strlen (prefixes[i])) != 0)
+        continue;
+
+      rest = s + strlen (prefixes[i]);
+      snprintf (buffer, sizeof buffer, "spotify:%s", rest);
+      p = strchr (buffer, '?');
+      if (p)
+        *p = '\0';
+      for (p = buffer; *p; p++)
+        if (*p == '/')
+          *p = ':';
+      snprintf (s, len, "%s", buffer);
+      return;
+    }
+}
+
+/* Read the next link of the file and start loading its track.  */
+static void
+read_link ()
+{
+  struct import_item *item;
+  char line[1024], *s, *end;
+  sp_link *link;
+
+  if (fgets (line, sizeof line, g_in) == NULL)
+    {
+      fclose (g_in);
+      g_in = NULL;
+      return;
+    }
+  g_line++;
+
+  for (s = line; isspace ((unsigned char) *s); s++)
+    ;
+  for (end = s + strlen (s); end > s && isspace ((unsigned char) end[-1]);
+       end--)
+    ;
+  *end = '\0';
+  if (*s == '\0' || *s == '#')
+    return;
+
+  item = &g_window[(g_head + g_count) % IMPORT_MAX_PENDING];
+  snprintf (item->link, sizeof item->link, "%s", s);
+  url_to_link (item->link, sizeof item->link);
+
+  link = sp_link_create_from_string (item->link);
+  if (link == NULL || sp_link_type (link) != SP_LINKTYPE_TRACK)
+    {
+      fail (g_line, item->link, "not a track link");
+      if (link)
+        sp_link_release (link);
+      return;
+    }
+
+  item->track = sp_link_as_track (link);
+  sp_track_add_ref (item->track);
+  sp_link_release (link);
+  item->line = g_line;
+  item->since = now_ms ();
+  g_count++;
+}
+
+static void
+flush_batch ()
+{
+  int i;
+
+  if (g_n_batch == 0)
+    return;
+
+  if (g_playlist)
+    {
+      sp_error err = sp_playlist_add_tracks (g_playlist, g_batch, g_n_batch,
+                                             sp_playlist_num_tracks (g_playlist),
+                                             g_session);
+      if (err == SP_ERROR_OK)
+        g_added += g_n_batch;
+      else
+        fail_batch (sp_error_message (err));
+    }
+  else
+    for (i = 0; i < g_n_batch; i++)
+      {
+        if (queue_add (g_queue, g_batch[i]))
+          g_added++;
+        else
+          fail (0, "", "cannot grow the queue");
+      }
+
+  for (i = 0; i < g_n_batch; i++)
+    sp_track_release (g_batch[i]);
+  g_n_batch = 0;
+}
+
+static void
+stop (int state)
+{
+  int i;
+
+  for (; g_count; g_count--, g_head = (g_head + 1) % IMPORT_MAX_PENDING)
+    sp_track_release (g_window[g_head].track);
+  for (i = 0; i < g_n_batch; i++)
+    sp_track_release (g_batch[i]);
+  g_n_batch = 0;
+
+  if (g_in)
+    fclose (g_in);
+  if (g_log)
+    fclose (g_log);
+  if (g_playlist)
+    sp_playlist_release (g_playlist);
+  g_in = g_log = NULL;
+  g_playlist = NULL;
+  g_queue = NULL;
+  g_state = state;
+}
+
+int
+import_start (sp_session *session, const char *path, sp_playlist *pl,
+              queue_t *queue)
+{
+  if (g_state == IMPORT_RUNNING)
+    return -1;
+
+  g_in = fopen (path, "r");
+  if (g_in == NULL)
+    return -1;
+
+  g_log = fopen (IMPORT_LOG, "w");
+  g_session = session;
+  g_playlist = pl;
+  if (pl)
+    sp_playlist_add_ref (pl);
+  g_queue = queue;
+  g_line = g_added = g_failed = 0;
+  g_head = g_count = 0;
+  g_state = IMPORT_RUNNING;
+  return 0;
+}
+
+void
+import_cancel ()
+{
+  if (g_state == IMPORT_RUNNING)
+    stop (IMPORT_IDLE);
+}
+
+void
+import_process ()
+{
+  int budget = IMPORT_READ_CHUNK;
+
+  if (g_state != IMPORT_RUNNING)
+    return;
+
+  while (g_in && g_count < IMPORT_MAX_PENDING && budget-- > 0)
+    read_link ();
+
+  /* Keep the order of the file: wait for the first track.  */
+  while (g_count)
+    {
+      struct import_item *item = &g_window[g_head];
+      sp_error err = sp_track_error (item->track);
+
+      if (err == SP_ERROR_IS_LOADING
+          && now_ms () - item->since < IMPORT_TIMEOUT_MS)
+        break;
+
+      if (err == SP_ERROR_OK)
+        {
+          g_batch[g_n_batch++] = item->track;
+          if (g_n_batch == IMPORT_BATCH)
+            flush_batch ();
+        }
+      else
+        {
+          fail (item->line, item->link, err == SP_ERROR_IS_LOADING
+                ? "timed out" : sp_error_message (err));
+          sp_track_release (item->track);
+        }
+
+      g_head = (g_head + 1) % IMPORT_MAX_PENDING;
+      g_count--;
+    }
+
+  if (g_in == NULL && g_count == 0)
+    {
+      flush_batch ();
+      stop (IMPORT_DONE);
+    }
+}
+
+int
+import_progress (char *buffer, size_t len, bool *done)
+{
+  if (g_state == IMPORT_IDLE)
+    return -1;
+
+  *done = g_state == IMPORT_DONE;
+  if (*done)
+    g_state = IMPORT_IDLE;
+
+  snprintf (buffer, len, "import: %d lines, %d added, %d failed%s", g_line,
+            g_added, g_failed,
+            *done && g_failed ? " (see ~/.shpotify/" IMPORT_LOG ")" : "");
+  return 0;
+}
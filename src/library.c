@@ -0,0 +1,734 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shpotify.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Local index of the tracks in the starred playlist and in the
+   playlists of the container, to search the library without asking the
+   service.
+
+   The index is a file mapped in memory:
+
+     struct library_header
+     uint32_t buckets[LIBRARY_BUCKETS + 1]   start of every posting list
+     uint32_t postings[]                     track ids, ascending
+     uint32_t entries[n_tracks]              offset of every entry in the pool
+     char pool[]                             "<link>\0<text>\0" per track
+
+   The text is the lowercased name, artist and album of the track.  A
+   bucket folds a trigram of the text in 15 bits, so its posting list
+   holds the tracks that may contain the trigram; the candidates are
+   checked against the text.
+
+   Every walk of the playlists builds the set of tracks again: the
+   tracks already in the file are only marked as still there, the new
+   ones are kept in memory.  At the end of a complete walk the file is
+   written again with the marked and the new tracks, so the tracks
+   unstarred or removed from the playlists are dropped.  A walk that
+   could not load everything only adds the new tracks.  */
+
+#define LIBRARY_MAGIC "shplib\0\0"
+#define LIBRARY_VERSION 1
+#define LIBRARY_BUCKETS (1 << 15)
+
+struct library_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t n_tracks;
+  uint32_t n_postings;
+  uint32_t pool_size;
+};
+
+static sp_session *g_session;
+static sp_playlist *g_starred;
+static char g_path[256];
+
+static void *g_map;
+static size_t g_map_size;
+static const struct library_header *g_header;
+static const uint32_t *g_buckets, *g_postings, *g_entries;
+static const char *g_pool;
+
+/* Entries found since the file was written.  */
+static char **g_pending;
+static size_t g_n_pending, g_pending_allocated;
+
+/* Hashes of the links of the tracks found by the current walk.  */
+static uint64_t *g_seen;
+static size_t g_n_seen_slots, g_n_seen;
+
+/* The id in the file of every link hash, open addressing on
+   G_N_FILE_SLOTS, and whether the current walk found the track.  */
+struct file_slot
+{
+  uint64_t hash;
+  uint32_t id;
+};
+static struct file_slot *g_file_ids;
+static size_t g_n_file_slots;
+static bool *g_kept;
+static size_t g_n_kept;
+
+/* Walk of the playlists: -1 is the starred playlist, then the rows of
+   the container.  */
+static bool g_walking;
+static int g_walk_row, g_walk_track;
+static bool g_walk_incomplete;
+static unsigned long g_walk_generation, g_walk_starred;
+static long long g_next_walk;
+
+static int
+fold (unsigned char c)
+{
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 1;
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A' + 1;
+  if (c >= '0' && c <= '9')
+    return 27 + (c - '0') % 3;
+  if (c >= 0x80)
+    return 30 + (c & 1);
+  return 0;
+}
+
+static unsigned
+bucket_of (const char *s)
+{
+  return (fold (s[0]) << 10) | (fold (s[1]) << 5) | fold (s[2]);
+}
+
+static void
+lowercase (char *dst, const char *src, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i + 1 < len && src[i]; i++)
+    dst[i] = src[i] >= 'A' && src[i] <= 'Z' ? src[i] - 'A' + 'a' : src[i];
+  dst[i] = '\0';
+}
+
+static uint64_t
+hash_link (const char *link)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  while (*link)
+    h = (h ^ (unsigned char) *link++) * 0x100000001b3ULL;
+
+  /* 0 marks an empty slot.  */
+  return h ? h : 1;
+}
+
+static uint64_t *
+seen_lookup (uint64_t h)
+{
+  size_t i;
+
+  for (i = h & (g_n_seen_slots - 1); g_seen[i] && g_seen[i] != h;
+       i = (i + 1) & (g_n_seen_slots - 1))
+    ;
+  return &g_seen[i];
+}
+
+/* Remember the link hashed to H, return false if it already was.  */
+static bool
+seen_add (uint64_t h)
+{
+  uint64_t *slot;
+
+  if ((g_n_seen + 1) * 2 > g_n_seen_slots)
+    {
+      uint64_t *old = g_seen;
+      size_t i, old_n = g_n_seen_slots;
+
+      g_n_seen_slots = old_n ? old_n * 2 : 1024;
+      g_seen = calloc (g_n_seen_slots, sizeof *g_seen);
+      if (g_seen == NULL)
+        {
+          g_seen = old;
+          g_n_seen_slots = old_n;
+          return false;
+        }
+
+      for (i = 0; i < old_n; i++)
+        if (old[i])
+          *seen_lookup (old[i]) = old[i];
+      free (old);
+    }
+
+  slot = seen_lookup (h);
+  if (*slot)
+    return false;
+
+  *slot = h;
+  g_n_seen++;
+  return true;
+}
+
+static size_t
+n_tracks ()
+{
+  return g_header ? g_header->n_tracks : 0;
+}
+
+/* The link of the track ID, its text follows it.  */
+static const char *
+entry (size_t id)
+{
+  if (id < n_tracks ())
+    return g_pool + g_entries[id];
+  return g_pending[id - n_tracks ()];
+}
+
+/* Index the tracks of the file by the hash of their link.  */
+static void
+index_file ()
+{
+  size_t id, n = n_tracks ();
+
+  free (g_file_ids);
+  free (g_kept);
+  g_file_ids = NULL;
+  g_kept = NULL;
+  g_n_file_slots = g_n_kept = 0;
+  if (n == 0)
+    return;
+
+  for (g_n_file_slots = 1024; g_n_file_slots < n * 2; g_n_file_slots *= 2)
+    ;
+  g_file_ids = calloc (g_n_file_slots, sizeof *g_file_ids);
+  g_kept = calloc (n, sizeof *g_kept);
+  if (g_file_ids == NULL || g_kept == NULL)
+    {
+      free (g_file_ids);
+      free (g_kept);
+      g_file_ids = NULL;
+      g_kept = NULL;
+      g_n_file_slots = 0;
+      return;
+    }
+
+  for (id = 0; id < n; id++)
+    {
+      uint64_t h = hash_link (entry (id));
+      size_t i;
+
+      for (i = h & (g_n_file_slots - 1); g_file_ids[i].hash;
+           i = (i + 1) & (g_n_file_slots - 1))
+        ;
+      g_file_ids[i].hash = h;
+      g_file_ids[i].id = id;
+    }
+}
+
+/* The id in the file of the track whose link hashes to H, or -1.  */
+static long
+file_id (uint64_t h)
+{
+  size_t i;
+
+  if (g_file_ids == NULL)
+    return -1;
+
+  for (i = h & (g_n_file_slots - 1); g_file_ids[i].hash;
+       i = (i + 1) & (g_n_file_slots - 1))
+    if (g_file_ids[i].hash == h)
+      return g_file_ids[i].id;
+  return -1;
+}
+
+static void
+seen_clear ()
+{
+  free (g_seen);
+  g_seen = NULL;
+  g_n_seen = g_n_seen_slots = 0;
+}
+
+static void
+unmap ()
+{
+  if (g_map)
+    munmap (g_map, g_map_size);
+  g_map = NULL;
+  g_header = NULL;
+}
+
+static void
+map ()
+{
+  const struct library_header *h;
+  size_t size;
+  struct stat st;
+  int fd = open (g_path, O_RDONLY);
+
+  if (fd < 0)
+    return;
+
+  if (fstat (fd, &st) < 0 || (size_t) st.st_size < sizeof *h)
+    {
+      close (fd);
+      return;
+    }
+
+  g_map_size = st.st_size;
+  g_map = mmap (NULL, g_map_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (g_map == MAP_FAILED)
+    {
+      g_map = NULL;
+      return;
+    }
+
+  /* An index in another format or truncated is built again.  */
+  h = g_map;
+  size = sizeof *h + (LIBRARY_BUCKETS + 1 + (size_t) h->n_postings
+                      + h->n_tracks) * sizeof (uint32_t) + h->pool_size;
+  if (memcmp (h->magic, LIBRARY_MAGIC, sizeof h->magic)
+      || h->version != LIBRARY_VERSION || size != g_map_size)
+    {
+      unmap ();
+      return;
+    }
+
+  g_header = h;
+  g_buckets = (const uint32_t *) (h + 1);
+  g_postings = g_buckets + LIBRARY_BUCKETS + 1;
+  g_entries = g_postings + h->n_postings;
+  g_pool = (const char *) (g_entries + h->n_tracks);
+}
+
+/* Count in COUNTS, or store in POSTINGS at the position given by
+   COUNTS, the buckets of the text of the N ENTRIES.  */
+static void
+add_postings (const char **entries, size_t n, uint32_t *counts,
+              uint32_t *last, uint32_t *postings)
+{
+  size_t id;
+
+  memset (last, 0xff, LIBRARY_BUCKETS * sizeof *last);
+  for (id = 0; id < n; id++)
+    {
+      const char *text = entries[id];
+      text += strlen (text) + 1;
+
+      for (; text[0] && text[1] && text[2]; text++)
+        {
+          unsigned b = bucket_of (text);
+          if (last[b] == id)
+            continue;
+          last[b] = id;
+          if (postings)
+            postings[counts[b]++] = id;
+          else
+            counts[b + 1]++;
+        }
+    }
+}
+
+/* Write the index with the pending entries and, with PRUNE, only the
+   tracks of the file found by the walk.  Map it again.  */
+static int
+save (bool prune)
+{
+  struct library_header h;
+  size_t id, n = 0;
+  uint32_t *buckets, *last, *postings = NULL, offset = 0;
+  const char **entries;
+  char tmp[sizeof g_path + 4];
+  FILE *out;
+  int i, ret = -1;
+
+  buckets = calloc (LIBRARY_BUCKETS + 1, sizeof *buckets);
+  last = malloc (LIBRARY_BUCKETS * sizeof *last);
+  entries = malloc ((n_tracks () + g_n_pending + 1) * sizeof *entries);
+  if (buckets == NULL || last == NULL || entries == NULL)
+    goto out;
+
+  for (id = 0; id < n_tracks (); id++)
+    if (!prune || (g_kept && g_kept[id]))
+      entries[n++] = entry (id);
+  for (id = 0; id < g_n_pending; id++)
+    entries[n++] = g_pending[id];
+
+  add_postings (entries, n, buckets, last, NULL);
+  for (i = 0; i < LIBRARY_BUCKETS; i++)
+    buckets[i + 1] += buckets[i];
+
+  postings = malloc ((buckets[LIBRARY_BUCKETS] + 1) * sizeof *postings);
+  if (postings == NULL)
+    goto out;
+
+  /* Filling the lists moves every start to the next one.  */
+  add_postings (entries, n, buckets, last, postings);
+  memmove (buckets + 1, buckets, LIBRARY_BUCKETS * sizeof *buckets);
+  buckets[0] = 0;
+
+  memset (&h, 0, sizeof h);
+  memcpy (h.magic, LIBRARY_MAGIC, sizeof h.magic);
+  h.version = LIBRARY_VERSION;
+  h.n_tracks = n;
+  h.n_postings = buckets[LIBRARY_BUCKETS];
+
+  snprintf (tmp, sizeof tmp, "%s.new", g_path);
+  out = fopen (tmp, "w");
+  if (out == NULL)
+    goto out;
+
+  for (id = 0; id < n; id++)
+    {
+      const char *e = entries[id];
+      size_t len = strlen (e) + 1;
+      len += strlen (e + len) + 1;
+      h.pool_size += len;
+    }
+
+  fwrite (&h, sizeof h, 1, out);
+  fwrite (buckets, sizeof *buckets, LIBRARY_BUCKETS + 1, out);
+  fwrite (postings, sizeof *postings, h.n_postings, out);
+  for (id = 0; id < n; id++)
+    {
+      const char *e = entries[id];
+      size_t len = strlen (e) + 1;
+      fwrite (&offset, sizeof offset, 1, out);
+      offset += len + strlen (e + len) + 1;
+    }
+  for (id = 0; id < n; id++)
+    {
+      const char *e = entries[id];
+      size_t len = strlen (e) + 1;
+      fwrite (e, 1, len + strlen (e + len) + 1, out);
+    }
+
+  if (fclose (out) != 0 || rename (tmp, g_path) < 0)
+    {
+      unlink (tmp);
+      goto out;
+    }
+
+  unmap ();
+  map ();
+  index_file ();
+  for (id = 0; id < g_n_pending; id++)
+    free (g_pending[id]);
+  g_n_pending = 0;
+  ret = 0;
+
+ out:
+  free (buckets);
+  free (last);
+  free (postings);
+  free (entries);
+  return ret;
+}
+
+static const char *
+artist_name (sp_track *track)
+{
+  sp_artist *artist;
+
+  if (sp_track_num_artists (track) == 0)
+    return "";
+
+  artist = sp_track_artist (track, 0);
+  return sp_artist_is_loaded (artist) ? sp_artist_name (artist) : NULL;
+}
+
+static void
+index_track (sp_track *track)
+{
+  sp_album *album;
+  const char *artist;
+  char link[256], text[512], *e, **pending;
+  size_t len;
+  long id;
+  uint64_t h;
+  sp_link *l;
+
+  if (!sp_track_is_loaded (track))
+    {
+      g_walk_incomplete = true;
+      return;
+    }
+
+  l = sp_link_create_from_track (track, 0);
+  if (l == NULL)
+    return;
+  len = sp_link_as_string (l, link, sizeof link);
+  sp_link_release (l);
+  if (len == 0 || len >= sizeof link)
+    return;
+
+  h = hash_link (link);
+  if (!seen_add (h))
+    return;
+
+  /* Already in the file, it stays there.  */
+  id = file_id (h);
+  if (id >= 0)
+    {
+      if (!g_kept[id])
+        g_n_kept++;
+      g_kept[id] = true;
+      return;
+    }
+
+  album = sp_track_album (track);
+  artist = artist_name (track);
+  if (artist == NULL || (album && !sp_album_is_loaded (album)))
+    {
+      g_walk_incomplete = true;
+      return;
+    }
+
+  if (g_n_pending == g_pending_allocated)
+    {
+      size_t n = g_pending_allocated ? g_pending_allocated * 2 : 256;
+      pending = realloc (g_pending, n * sizeof *pending);
+      if (pending == NULL)
+        return;
+      g_pending = pending;
+      g_pending_allocated = n;
+    }
+
+  snprintf (text, sizeof text, "%s %s %s", sp_track_name (track), artist,
+            album ? sp_album_name (album) : "");
+  e = malloc (len + 1 + strlen (text) + 1);
+  if (e == NULL)
+    return;
+
+  strcpy (e, link);
+  lowercase (e + len + 1, text, strlen (text) + 1);
+  g_pending[g_n_pending++] = e;
+}
+
+/* The playlist at the walk position, skipping the rows that are not
+   playlists, or NULL at the end of the walk.  A walk cut short by a
+   container not loaded or changed is incomplete.  */
+static sp_playlist *
+walk_playlist ()
+{
+  struct search_result *rows;
+
+  if (g_walk_row < 0)
+    return g_starred;
+
+  rows = container_rows ();
+  if (rows == NULL || g_walk_generation != container_generation ())
+    {
+      g_walk_incomplete = true;
+      return NULL;
+    }
+
+  for (; rows[g_walk_row].type; g_walk_row++)
+    if (rows[g_walk_row].type == TYPE_PLAYLIST)
+      return rows[g_walk_row].playlist;
+
+  return NULL;
+}
+
+void
+library_process ()
+{
+  int budget = LIBRARY_CHUNK;
+  size_t i;
+
+  if (g_session == NULL)
+    return;
+
+  if (!g_walking)
+    {
+      if (now_ms () < g_next_walk
+          && g_walk_generation == container_generation ()
+          && g_walk_starred == starred_generation ())
+        return;
+
+      g_walking = true;
+      g_walk_incomplete = false;
+      seen_clear ();
+      /* Left by a save that failed.  */
+      for (i = 0; i < g_n_pending; i++)
+        seen_add (hash_link (g_pending[i]));
+      if (g_kept)
+        memset (g_kept, 0, n_tracks () * sizeof *g_kept);
+      g_n_kept = 0;
+      g_walk_row = -1;
+      g_walk_track = 0;
+      g_walk_generation = container_generation ();
+      g_walk_starred = starred_generation ();
+    }
+
+  while (budget > 0)
+    {
+      sp_playlist *pl = walk_playlist ();
+      int n;
+
+      if (pl == NULL)
+        {
+          g_walking = false;
+          g_next_walk = now_ms () + (g_walk_incomplete ? LIBRARY_RETRY_MS
+                                     : LIBRARY_RESCAN_MS);
+          if (!g_walk_incomplete && g_n_kept < n_tracks ())
+            save (true);
+          else if (g_n_pending)
+            save (false);
+          return;
+        }
+
+      /* Its tracks are indexed by a later walk.  */
+      if (!sp_playlist_is_loaded (pl))
+        g_walk_incomplete = true;
+
+      n = sp_playlist_is_loaded (pl) ? sp_playlist_num_tracks (pl) : 0;
+      for (; g_walk_track < n && budget > 0; g_walk_track++, budget--)
+        index_track (sp_playlist_track (pl, g_walk_track));
+
+      if (g_walk_track >= n)
+        {
+          g_walk_row++;
+          g_walk_track = 0;
+        }
+    }
+}
+
+/* The matches are returned as links, only the rows shown get their
+   object from libspotify.  */
+static void
+add_result (struct search_result *sr, int *n, const char *e,
+            const char *query, struct arena *a)
+{
+  char *link;
+
+  if (!strstr (e + strlen (e) + 1, query))
+    return;
+
+  link = arena_alloc (a, strlen (e) + 1);
+  if (link == NULL)
+    return;
+  strcpy (link, e);
+  sr[*n].type = TYPE_LINK;
+  sr[*n].link = link;
+  (*n)++;
+}
+
+struct search_result *
+library_search (const char *query, struct arena *a, int max)
+{
+  struct search_result *sr = arena_alloc (a, (max + 1) * sizeof *sr);
+  char q[64];
+  size_t i, from = 0, to = n_tracks (), len;
+  const uint32_t *ids = NULL;
+  int n = 0;
+
+  if (sr == NULL)
+    return NULL;
+
+  lowercase (q, query, sizeof q);
+  len = strlen (q);
+
+  /* Only the tracks in the shortest posting list of the query may
+     match.  */
+  if (g_header && len >= 3)
+    {
+      ids = g_postings;
+      from = g_buckets[bucket_of (q)];
+      to = g_buckets[bucket_of (q) + 1];
+      for (i = 1; i + 2 < len; i++)
+        {
+          unsigned b = bucket_of (q + i);
+          if (g_buckets[b + 1] - g_buckets[b] < to - from)
+            {
+              from = g_buckets[b];
+              to = g_buckets[b + 1];
+            }
+        }
+    }
+
+  for (i = from; i < to && n < max; i++)
+    add_result (sr, &n, entry (ids ? ids[i] : i), q, a);
+
+  for (i = 0; i < g_n_pending && n < max; i++)
+    add_result (sr, &n, g_pending[i], q, a);
+
+  sr[n].type = TYPE_LAST;
+  return sr;
+}
+
+void
+library_start (sp_session *session)
+{
+  g_session = session;
+  snprintf (g_path, sizeof g_path, "library-%s",
+            sp_session_user_name (session));
+  map ();
+  index_file ();
+
+  g_starred = sp_session_starred_create (session);
+  g_walking = false;
+  g_next_walk = 0;
+}
+
+void
+library_stop ()
+{
+  size_t i;
+
+  if (g_session == NULL)
+    return;
+
+  /* The walk may not be over, nothing is dropped.  */
+  if (g_n_pending)
+    save (false);
+  for (i = 0; i < g_n_pending; i++)
+    free (g_pending[i]);
+  free (g_pending);
+  g_pending = NULL;
+  g_n_pending = g_pending_allocated = 0;
+
+  seen_clear ();
+  free (g_file_ids);
+  free (g_kept);
+  g_file_ids = NULL;
+  g_kept = NULL;
+  g_n_file_slots = g_n_kept = 0;
+
+  unmap ();
+  if (g_starred)
+    sp_playlist_release (g_starred);
+  g_starred = NULL;
+  g_session = NULL;
+}
@@ -0,0 +1,109 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shpotify.h"
+
+#include <curses.h>
+#include <time.h>
+
+/* Time the list view on a list of BENCH_ROWS rows, drawn to /dev/null:
+   every operation must cost the rows of the viewport, not the rows of
+   the list.  Build it with "make listview-bench".  */
+
+#define BENCH_ROWS 100000
+#define BENCH_HEIGHT 40
+#define BENCH_KEYS 100000
+
+static unsigned long g_drawn;
+
+static double
+now_us ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void
+draw_row (struct listview *lv, size_t row, int y, bool selected, void *data)
+{
+  char buffer[64];
+
+  snprintf (buffer, sizeof buffer, "Track number %zu", row);
+  mvaddnstr (y, lv->x, buffer, lv->w);
+  g_drawn++;
+}
+
+static void
+report (const char *what, double start, int n)
+{
+  printf ("%-24s %8.2f us per call, %6.1f rows drawn per call\n", what,
+          (now_us () - start) / n, (double) g_drawn / n);
+  g_drawn = 0;
+}
+
+int
+main ()
+{
+  static const int keys[] = { KEY_DOWN, KEY_UP, KEY_NPAGE, KEY_PPAGE };
+  FILE *out = fopen ("/dev/null", "w");
+  struct listview lv;
+  double start;
+  int i;
+
+  if (out == NULL || newterm ("xterm", out, stdin) == NULL)
+    {
+      fprintf (stderr, "Cannot start curses\n");
+      return 1;
+    }
+
+  listview_init (&lv, 1, 1, BENCH_HEIGHT, 60, draw_row, NULL);
+  start = now_us ();
+  listview_set_count (&lv, BENCH_ROWS);
+  report ("set count", start, 1);
+
+  start = now_us ();
+  listview_draw (&lv);
+  report ("first draw", start, 1);
+
+  start = now_us ();
+  for (i = 0; i < BENCH_KEYS; i++)
+    if (listview_key (&lv, keys[i % 4]))
+      listview_draw (&lv);
+  report ("key and redraw", start, BENCH_KEYS);
+
+  start = now_us ();
+  for (i = 0; i < BENCH_KEYS; i++)
+    {
+      listview_key (&lv, i % 2 ? KEY_END : KEY_HOME);
+      listview_draw (&lv);
+    }
+  report ("home/end and redraw", start, BENCH_KEYS);
+
+  endwin ();
+  return 0;
+}
@@ -0,0 +1,143 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shpotify.h"
+
+#include <curses.h>
+
+/* Keep the cursor inside the viewport.  */
+static void
+listview_scroll (struct listview *lv)
+{
+  if (lv->cursor < lv->top)
+    lv->top = lv->cursor;
+  else if (lv->cursor >= lv->top + lv->h)
+    lv->top = lv->cursor - lv->h + 1;
+
+  if (lv->top + lv->h > lv->count)
+    lv->top = lv->count > lv->h ? lv->count - lv->h : 0;
+}
+
+void
+listview_init (struct listview *lv, int y, int x, int h, int w,
+               listview_draw_cb draw_row, void *data)
+{
+  lv->y = y;
+  lv->x = x;
+  lv->h = max (h, 1);
+  lv->w = w;
+  lv->draw_row = draw_row;
+  lv->data = data;
+  lv->count = 0;
+  lv->cursor = 0;
+  lv->top = 0;
+}
+
+void
+listview_set_count (struct listview *lv, size_t count)
+{
+  lv->count = count;
+  if (lv->cursor >= count)
+    lv->cursor = count ? count - 1 : 0;
+  listview_scroll (lv);
+}
+
+void
+listview_set_cursor (struct listview *lv, size_t cursor)
+{
+  lv->cursor = cursor;
+  listview_set_count (lv, lv->count);
+}
+
+bool
+listview_key (struct listview *lv, int c)
+{
+  if (lv->count == 0)
+    return false;
+
+  switch (c)
+    {
+    case KEY_DOWN:
+      if (lv->cursor + 1 < lv->count)
+        lv->cursor++;
+      break;
+
+    case KEY_UP:
+      if (lv->cursor)
+        lv->cursor--;
+      break;
+
+    case KEY_NPAGE:
+      lv->cursor = min (lv->cursor + lv->h, lv->count - 1);
+      break;
+
+    case KEY_PPAGE:
+      lv->cursor = lv->cursor > lv->h ? lv->cursor - lv->h : 0;
+      break;
+
+    case KEY_HOME:
+      lv->cursor = 0;
+      break;
+
+    case KEY_END:
+      lv->cursor = lv->count - 1;
+      break;
+
+    default:
+      return false;
+    }
+
+  listview_scroll (lv);
+  return true;
+}
+
+/* Draw again a single row, if it is visible.  */
+void
+listview_draw_row (struct listview *lv, size_t row)
+{
+  if (row < lv->top || row >= lv->top + lv->h || row >= lv->count)
+    return;
+
+  lv->draw_row (lv, row, lv->y + (row - lv->top), row == lv->cursor, lv->data);
+}
+
+/* Only the rows in the viewport are formatted, whatever the size of the
+   list.  */
+void
+listview_draw (struct listview *lv)
+{
+  int i;
+
+  for (i = 0; i < lv->h; i++)
+    {
+      size_t row = lv->top + i;
+      if (row < lv->count)
+        lv->draw_row (lv, row, lv->y + i, row == lv->cursor, lv->data);
+      else
+        mvhline (lv->y + i, lv->x, ' ', lv->w);
+    }
+}
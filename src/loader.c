@@ -0,0 +1,351 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shpotify.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+enum
+  {
+    LOAD_PLAYLIST,
+    LOAD_CONTAINER,
+    LOAD_ALBUMBROWSE,
+    LOAD_ARTISTBROWSE
+  };
+
+/* The spans of the trace.  */
+static const char *const g_kind_names[] =
+  {
+    "playlist load", "container load", "album browse", "artist browse"
+  };
+
+struct load_request
+{
+  struct load_request *next;
+  int kind;
+  union
+  {
+    sp_playlist *playlist;
+    sp_playlistcontainer *container;
+    sp_albumbrowse *albumbrowse;
+    sp_artistbrowse *artistbrowse;
+  };
+  long long started;
+  long long deadline;
+  /* Set by the libspotify callbacks.  */
+  bool done;
+  load_cb cb;
+  void *data;
+};
+
+static struct load_request *g_requests;
+
+static void
+albumbrowse_complete (sp_albumbrowse *result, void *userdata)
+{
+  struct load_request *req = userdata;
+  req->done = true;
+}
+
+static void
+artistbrowse_complete (sp_artistbrowse *result, void *userdata)
+{
+  struct load_request *req = userdata;
+  req->done = true;
+}
+
+static void
+playlist_state_changed (sp_playlist *pl, void *userdata)
+{
+  struct load_request *req = userdata;
+  if (sp_playlist_is_loaded (pl))
+    req->done = true;
+}
+
+static void
+container_loaded (sp_playlistcontainer *pc, void *userdata)
+{
+  struct load_request *req = userdata;
+  req->done = true;
+}
+
+static sp_playlist_callbacks g_playlist_callbacks =
+  {
+    .playlist_state_changed = playlist_state_changed
+  };
+
+static sp_playlistcontainer_callbacks g_container_callbacks =
+  {
+    .container_loaded = container_loaded
+  };
+
+static struct load_request *
+load_new (int kind, int timeout, load_cb cb, void *data)
+{
+  struct load_request *req = calloc (sizeof (struct load_request), 1);
+  if (req == NULL)
+    return NULL;
+
+  req->kind = kind;
+  req->started = now_ms ();
+  req->deadline = req->started + timeout;
+  req->cb = cb;
+  req->data = data;
+  req->next = g_requests;
+  g_requests = req;
+  trace_async_begin (g_kind_names[kind], req);
+  return req;
+}
+
+/* Hand REQ over to a new owner, with a new timeout.  */
+void
+load_retarget (struct load_request *req, int timeout, load_cb cb, void *data)
+{
+  req->deadline = now_ms () + timeout;
+  req->cb = cb;
+  req->data = data;
+}
+
+struct load_request *
+load_playlist (sp_playlist *pl, int timeout, load_cb cb, void *data)
+{
+  struct load_request *req = load_new (LOAD_PLAYLIST, timeout, cb, data);
+  if (req == NULL)
+    return NULL;
+
+  req->playlist = pl;
+  sp_playlist_add_ref (pl);
+  sp_playlist_add_callbacks (pl, &g_playlist_callbacks, req);
+  return req;
+}
+
+struct load_request *
+load_container (sp_playlistcontainer *pc, int timeout, load_cb cb, void *data)
+{
+  struct load_request *req = load_new (LOAD_CONTAINER, timeout, cb, data);
+  if (req == NULL)
+    return NULL;
+
+  req->container = pc;
+  sp_playlistcontainer_add_ref (pc);
+  sp_playlistcontainer_add_callbacks (pc, &g_container_callbacks, req);
+  return req;
+}
+
+struct load_request *
+load_albumbrowse (sp_session *session, sp_album *album, int timeout,
+                  load_cb cb, void *data)
+{
+  struct load_request *req = load_new (LOAD_ALBUMBROWSE, timeout, cb, data);
+  if (req == NULL)
+    return NULL;
+
+  req->albumbrowse = sp_albumbrowse_create (session, album,
+                                            albumbrowse_complete, req);
+  if (req->albumbrowse == NULL)
+    {
+      load_cancel (req);
+      return NULL;
+    }
+  return req;
+}
+
+struct load_request *
+load_artistbrowse (sp_session *session, sp_artist *artist,
+                   sp_artistbrowse_type type, int timeout, load_cb cb,
+                   void *data)
+{
+  struct load_request *req = load_new (LOAD_ARTISTBROWSE, timeout, cb, data);
+  if (req == NULL)
+    return NULL;
+
+  req->artistbrowse = sp_artistbrowse_create (session, artist, type,
+                                              artistbrowse_complete, req);
+  if (req->artistbrowse == NULL)
+    {
+      load_cancel (req);
+      return NULL;
+    }
+  return req;
+}
+
+/* The callbacks are not called when the object was already loaded.  */
+static bool
+load_is_loaded (struct load_request *req)
+{
+  switch (req->kind)
+    {
+    case LOAD_PLAYLIST:
+      return sp_playlist_is_loaded (req->playlist);
+
+    case LOAD_CONTAINER:
+      return sp_playlistcontainer_is_loaded (req->container);
+
+    case LOAD_ALBUMBROWSE:
+      return sp_albumbrowse_is_loaded (req->albumbrowse);
+
+    case LOAD_ARTISTBROWSE:
+      return sp_artistbrowse_is_loaded (req->artistbrowse);
+    }
+
+  return false;
+}
+
+static sp_error
+load_error (struct load_request *req)
+{
+  switch (req->kind)
+    {
+    case LOAD_ALBUMBROWSE:
+      return sp_albumbrowse_error (req->albumbrowse);
+
+    case LOAD_ARTISTBROWSE:
+      return sp_artistbrowse_error (req->artistbrowse);
+    }
+
+  return SP_ERROR_OK;
+}
+
+static void
+load_unlink (struct load_request *req)
+{
+  struct load_request **it;
+
+  for (it = &g_requests; *it; it = &(*it)->next)
+    if (*it == req)
+      {
+        *it = req->next;
+        break;
+      }
+  req->next = NULL;
+}
+
+static void *
+load_object (struct load_request *req)
+{
+  switch (req->kind)
+    {
+    case LOAD_PLAYLIST:
+      return req->playlist;
+
+    case LOAD_CONTAINER:
+      return req->container;
+
+    case LOAD_ALBUMBROWSE:
+      return req->albumbrowse;
+
+    case LOAD_ARTISTBROWSE:
+      return req->artistbrowse;
+    }
+
+  return NULL;
+}
+
+void
+load_cancel (struct load_request *req)
+{
+  trace_async_end (g_kind_names[req->kind], req);
+  load_unlink (req);
+
+  switch (req->kind)
+    {
+    case LOAD_PLAYLIST:
+      sp_playlist_remove_callbacks (req->playlist, &g_playlist_callbacks, req);
+      sp_playlist_release (req->playlist);
+      break;
+
+    case LOAD_CONTAINER:
+      sp_playlistcontainer_remove_callbacks (req->container,
+                                             &g_container_callbacks, req);
+      sp_playlistcontainer_release (req->container);
+      break;
+
+    case LOAD_ALBUMBROWSE:
+      if (req->albumbrowse)
+        sp_albumbrowse_release (req->albumbrowse);
+      break;
+
+    case LOAD_ARTISTBROWSE:
+      if (req->artistbrowse)
+        sp_artistbrowse_release (req->artistbrowse);
+      break;
+    }
+
+  free (req);
+}
+
+/* Complete the loaded requests and expire the late ones.  The callbacks
+   may start or cancel other requests, so restart from the head after
+   each one.  */
+void
+load_process ()
+{
+  struct load_request *req;
+  long long now = now_ms ();
+
+ restart:
+  for (req = g_requests; req; req = req->next)
+    {
+      sp_error error;
+
+      if (!req->done)
+        req->done = load_is_loaded (req);
+
+      if (req->done)
+        error = load_error (req);
+      else if (now >= req->deadline)
+        error = LOAD_ERROR_TIMEOUT;
+      else
+        continue;
+
+      if (req->kind == LOAD_ALBUMBROWSE || req->kind == LOAD_ARTISTBROWSE)
+        metrics_record (METRIC_BROWSE, (now - req->started) * 1000);
+
+      load_unlink (req);
+      req->cb (load_object (req), error, req->data);
+      load_cancel (req);
+      goto restart;
+    }
+}
+
+int
+load_describe (struct load_request *req, char *buffer, size_t len)
+{
+  static const char *const what[] =
+    {
+      "playlist", "playlists", "album", "artist"
+    };
+  int seconds = (now_ms () - req->started) / 1000;
+  int n;
+
+  n = snprintf (buffer, len, "loading %s.. %is", what[req->kind], seconds);
+  if (req->kind == LOAD_PLAYLIST && sp_playlist_num_tracks (req->playlist))
+    n += snprintf (buffer + n, len > n ? len - n : 0, ", %i tracks",
+                   sp_playlist_num_tracks (req->playlist));
+  return n;
+}
@@ -33,7 +33,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <signal.h>
 #include <string.h>
 #include <locale.h>
+#include <errno.h>
+#include <limits.h>
+#include <getopt.h>
 #include <menu.h>
+#include <stdint.h>
+#include <time.h>
 #include "shpotify.h"
 #include "queue.h"
 
@@ -44,23 +49,133 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 static WINDOW *content_wnd;
 static WINDOW *g_mainwin;
 static int g_status, g_debug = 0;
+static bool g_persist_cache = true;
+/* Keep the metrics in METRICS_FILE from the start.  */
+static bool g_metrics_file;
+/* Run without the terminal, controlled through CONTROL_SOCKET.  */
+static bool g_daemon;
+/* Write the playlists to stdout in this format and exit, -1 when not
+   exporting.  */
+static int g_export = -1;
 static bool force_redraw = false;
+/* Changes every time the screen is cleared, to know when what was
+   drawn is gone.  */
+static unsigned long g_screen_generation;
 int g_h, g_w;
 struct search_result *g_search_results;
-struct search_result g_result_to_browse;
 static sp_session *g_session;
-static sp_search *g_search;
 static int g_force_refresh = 0;
 static int g_end_of_track = 0, g_seek_off = -1;
 static int g_paused = 0;
 static queue_t *g_play_queue;
-static void free_search_results (struct search_result *sr);
 static const char *search_result_get_name (struct search_result *sr);
-static sp_playlist *choose_playlist ();
+static void set_search_results (struct search_result *sr,
+                                sp_playlist *browsed);
 static int show_art (FILE * infile);
 static int g_elapsed_frames, g_sample_rate;
 static sp_track *g_current_track;
 static sp_playlist *g_browsed_playlist = NULL;
+static time_t g_status_since;
+static bool g_status_entered;
+static void idle_tick ();
+
+/* A list of search results.  The results are owned by whoever sets
+   them, the list only keeps what is needed to show them.  */
+struct result_list
+{
+  struct search_result *results;
+  bool open;
+  /* The results changed since the list was opened.  */
+  bool stale;
+  /* The visible rows must be drawn again.  */
+  bool dirty;
+  struct listview view;
+  /* Folder nesting of every row.  */
+  unsigned char *levels;
+  /* Name last drawn for every row, to find the rows changed by a
+     metadata update.  */
+  const char **drawn;
+  /* Star last drawn for every track row.  */
+  bool *stars;
+  unsigned long stars_generation;
+  /* Rows marked for the next batched operation, MARK_FROM is where a
+     range starts.  */
+  bool *marks;
+  size_t n_marked;
+  size_t mark_from;
+  /* Rows marked when the list was left for a batch that may still be
+     cancelled, marked again when it opens on the same results.  */
+  int *kept_marks;
+  int n_kept_marks;
+  /* The results shown are in arenas[front], the other one holds the
+     previous results until the next ones are built.  */
+  struct arena arenas[2];
+  int front;
+  /* The results belong to the container model: they are not released
+     nor modified, and their levels are the model ones.  */
+  bool shared;
+  const unsigned char *shared_levels;
+  unsigned long shared_generation;
+  /* LEVELS, DRAWN, STARS and MARKS, released when the list is
+     closed.  */
+  struct arena rows;
+  /* Rows the results will have once they are all filled.  */
+  size_t capacity;
+  /* Rows LEVELS, DRAWN, STARS and MARKS have room for.  */
+  size_t allocated;
+  /* Links of the rows whose object was released, and RECLAIMED, the
+     link of each row from its first release on, for RECLAIMED_SIZE
+     rows.  */
+  struct arena links;
+  const char **reclaimed;
+  size_t reclaimed_size;
+  /* First row shown the last time the rows were reclaimed.  */
+  size_t reclaimed_top;
+  /* With FILTERED, the view shows the rows of FILTER instead of all
+     the results.  FILTER_INPUT is set while the query is typed.  */
+  struct filter filter;
+  bool filtered;
+  bool filter_input;
+  char filter_query[64];
+  size_t filter_len;
+  size_t size;
+  int offset_x;
+  /* First row of the list, 1 when it is 0.  */
+  int top;
+  int selected_item;
+};
+
+static struct result_list g_browse_list;
+static int list_current (struct result_list *l);
+static void list_close (struct result_list *l);
+static void list_remember (struct result_list *l);
+static void list_drop_kept_marks (struct result_list *l);
+static void list_process (struct result_list *l, int c);
+static void list_set_results (struct result_list *l, struct search_result *sr,
+                              bool keep_selection);
+static struct arena *list_arena (struct result_list *l);
+static struct search_result *list_share_container (struct result_list *l,
+                                                  bool keep_selection);
+static void list_grow (struct result_list *l);
+static void list_extend (struct result_list *l, struct search_result *sr);
+static void list_restore (struct result_list *l, size_t from, size_t to);
+static void list_reset_links (struct result_list *l);
+static bool list_near_end (struct result_list *l);
+
+/* Playlist picker, used to add a track to a playlist.  */
+static struct result_list g_picker_list;
+static sp_track **g_tracks_to_add;
+static int g_n_tracks_to_add;
+static int g_picker_return;
+/* File whose links are imported in the playlist chosen in the picker,
+   instead of G_TRACKS_TO_ADD.  */
+static char g_import_path[PATH_MAX];
+/* Directory the program was started from, relative paths given by the
+   user start there.  */
+static char *g_start_dir;
+
+/* Track currently shown in the "now playing" screen.  */
+static sp_track *g_shown_track;
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
 
@@ -100,6 +215,34 @@ print_star (int y, int x, bool starred)
 }
 
 
+long long
+now_ms ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* Apply CH to the line in BUFFER.  Return true if the line changed.  */
+static bool
+edit_line (char *buffer, size_t len, size_t *so_far, int ch)
+{
+  if ((ch == KEY_BACKSPACE || ch == 127) && *so_far)
+    {
+      buffer[--*so_far] = '\0';
+      return true;
+    }
+
+  if (isprint (ch) && *so_far < len - 1)
+    {
+      buffer[(*so_far)++] = ch;
+      buffer[*so_far] = '\0';
+      return true;
+    }
+
+  return false;
+}
+
 static int
 read_line (char *buffer, size_t len, const char const *prompt)
 {
@@ -110,15 +253,11 @@ read_line (char *buffer, size_t len, const char const *prompt)
 
   curs_set (1);
 
-  attrset (COLOR_PAIR (COLOR_INPUT));
-
-  nodelay (g_mainwin, false);
-
   for (;;)
     {
-      size_t i;
       int ch;
 
+      attrset (COLOR_PAIR (COLOR_INPUT));
       mvaddnstr (g_h - 3, 1, prompt, g_w - 2);
       mvaddnstr (g_h - 3, prompt_len + 1, buffer, g_w - 2);
 
@@ -127,31 +266,28 @@ read_line (char *buffer, size_t len, const char const *prompt)
       if (so_far == len - 1)
         break;
 
-      ch = getch ();
+      /* Keep the session and the playback going while the user types.  */
+      ch = frame_getch (100);
+      if (ch == ERR)
+        {
+          attrset (COLOR_PAIR (COLOR_DEFAULT));
+          idle_tick ();
+          continue;
+        }
+
       if (ch == 27)
         {
           ret = 1;
           goto exit;
         }
 
-      if (ch == KEY_BACKSPACE && so_far)
-	{
-	  buffer[--so_far] = '\0';
-	  continue;
-	}
-
       if (ch == '\n')
 	break;
 
-      if (isprint (ch))
-        {
-          buffer[so_far++] = ch;
-          buffer[so_far] = '\0';
-        }
+      edit_line (buffer, len, &so_far, ch);
     }
 
  exit:
-  nodelay (g_mainwin, true);
   attrset (COLOR_PAIR (COLOR_DEFAULT));
   curs_set (0);
   return ret;
@@ -174,12 +310,30 @@ trim (char *buffer)
     }
 }
 
+/* The last message survives a screen change for a few seconds.  */
+static char g_last_msg[256];
+static time_t g_last_msg_time;
+
 static void
 msg_to_user (const char const *msg)
 {
   int i;
   size_t len = strlen (msg);
 
+  if (msg != g_last_msg)
+    {
+      snprintf (g_last_msg, sizeof g_last_msg, "%s", msg);
+      g_last_msg_time = time (NULL);
+    }
+
+  /* Before the terminal is set up, the message is shown with the first
+     screen.  The daemon sends it to its clients.  */
+  if (g_mainwin == NULL)
+    {
+      control_event ("message %s", msg);
+      return;
+    }
+
   attrset (COLOR_PAIR (COLOR_MESSAGE));
 
   mvaddnstr (g_h - 2, 1, msg, g_w - 2);
@@ -193,24 +347,56 @@ msg_to_user (const char const *msg)
 static void
 reset_screen ()
 {
+  g_screen_generation++;
+  if (g_mainwin == NULL)
+    return;
   erase ();
   box (g_mainwin, 0, 0);
+
+  if (g_last_msg[0] && time (NULL) - g_last_msg_time < 3)
+    msg_to_user (g_last_msg);
 }
 
+static void screen_leave (int status);
+
+/* The names of the statuses, for the trace.  */
+static const char *const g_status_names[] =
+  {
+    [STATUS_NOT_LOGGED] = "not logged",
+    [STATUS_LOGIN] = "login",
+    [STATUS_AUTOMATIC_LOGIN] = "automatic login",
+    [STATUS_LOGGING_IN] = "logging in",
+    [STATUS_HOME] = "home",
+    [STATUS_SEARCH_BROWSE] = "search browse",
+    [STATUS_BROWSE_SHOW] = "browse show",
+    [STATUS_BROWSE_SHOW_PLAYLISTS] = "browse show playlists",
+    [STATUS_LOADING] = "loading",
+    [STATUS_PLAYING] = "playing",
+    [STATUS_CHOOSE_PLAYLIST] = "choose playlist",
+    [STATUS_SEARCH_INPUT] = "search input",
+  };
+
 static int
 transition_to (int new_status)
 {
+  long long span = trace_begin ();
+
+  screen_leave (g_status);
   reset_screen ();
+  trace_end (g_status_names[new_status], span);
   g_status = new_status;
+  g_status_since = time (NULL);
+  g_status_entered = true;
+  return 0;
 }
 
-static int
-login ()
+static FIELD *g_login_field[3];
+static FORM *g_login_form;
+static int g_login_selected;
+
+static void
+login_open ()
 {
-  FIELD *field[3];
-  FORM *form;
-  char username[33], password[33];
-  int ch, selected = 0;
   int x = (g_w - 32) / 2;
   int y = g_h / 2;
 
@@ -218,84 +404,95 @@ login ()
 
   keypad (stdscr, TRUE);
 
-  field[0] = new_field (1, 32, y + 0, x, 0, 0);
-  field[1] = new_field (1, 32, y + 1, x, 0, 0);
-  field[2] = NULL;
+  g_login_field[0] = new_field (1, 32, y + 0, x, 0, 0);
+  g_login_field[1] = new_field (1, 32, y + 1, x, 0, 0);
+  g_login_field[2] = NULL;
+  g_login_selected = 0;
 
-  set_field_back (field[0], A_UNDERLINE);
-  field_opts_off (field[0], O_AUTOSKIP);
-  field_opts_off (field[0], O_STATIC);
+  set_field_back (g_login_field[0], A_UNDERLINE);
+  field_opts_off (g_login_field[0], O_AUTOSKIP);
+  field_opts_off (g_login_field[0], O_STATIC);
 
-  set_field_back (field[1], A_UNDERLINE);
-  field_opts_off (field[1], O_AUTOSKIP);
-  field_opts_off (field[1], O_PUBLIC);
+  set_field_back (g_login_field[1], A_UNDERLINE);
+  field_opts_off (g_login_field[1], O_AUTOSKIP);
+  field_opts_off (g_login_field[1], O_PUBLIC);
 
-  form = new_form (field);
-  set_form_win (form, content_wnd);
-  post_form (form);
+  g_login_form = new_form (g_login_field);
+  set_form_win (g_login_form, content_wnd);
+  post_form (g_login_form);
   box (g_mainwin, 0, 0);
 
   mvprintw (y - 1, x - 10, "Shpotify");
   mvprintw (y + 0, x - 10, "Username:");
   mvprintw (y + 1, x - 10, "Password:");
 
-  refresh ();
+  form_driver (g_login_form, REQ_FIRST_FIELD);
+}
+
+static void
+login_close ()
+{
+  if (g_login_form == NULL)
+    return;
+
+  /* Un post form and free the memory */
+  unpost_form (g_login_form);
+  free_form (g_login_form);
+  free_field (g_login_field[0]);
+  free_field (g_login_field[1]);
+  g_login_form = NULL;
+
+  curs_set (0);
+}
+
+static int
+login (int ch)
+{
+  char username[33], password[33];
 
-  form_driver (form, REQ_FIRST_FIELD);
+  if (g_login_form == NULL)
+    login_open ();
 
-  while (true)
+  switch (ch)
     {
-      ch = getch ();
+    case ERR:
+      return 0;
 
-      switch (ch)
-	{
-        case '\n':
-        if (selected == 1)
-          goto exit;
-        /*Fall trough.  */
-	case KEY_DOWN:
-	  selected = !selected;
-	  form_driver (form, REQ_NEXT_FIELD);
-	  form_driver (form, REQ_END_LINE);
-	  break;
+    case '\n':
+      if (g_login_selected == 1)
+        break;
+      /*Fall trough.  */
+    case KEY_DOWN:
+      g_login_selected = !g_login_selected;
+      form_driver (g_login_form, REQ_NEXT_FIELD);
+      form_driver (g_login_form, REQ_END_LINE);
+      return 0;
 
-	case KEY_UP:
-	  selected = !selected;
-	  form_driver (form, REQ_PREV_FIELD);
-	  form_driver (form, REQ_END_LINE);
-	  break;
+    case KEY_UP:
+      g_login_selected = !g_login_selected;
+      form_driver (g_login_form, REQ_PREV_FIELD);
+      form_driver (g_login_form, REQ_END_LINE);
+      return 0;
 
-	case KEY_BACKSPACE:
-	  form_driver (form, REQ_LEFT_CHAR);
-	  form_driver (form, REQ_DEL_CHAR);
+    case KEY_BACKSPACE:
+      form_driver (g_login_form, REQ_LEFT_CHAR);
+      form_driver (g_login_form, REQ_DEL_CHAR);
 
-	default:
-	  form_driver (form, ch);
-	  form_driver (form, REQ_VALIDATION);
-	  break;
-	}
+    default:
+      form_driver (g_login_form, ch);
+      form_driver (g_login_form, REQ_VALIDATION);
+      return 0;
     }
-exit:
-  strcpy (username, field_buffer (field[0], 0));
-  strcpy (password, field_buffer (field[1], 0));
+
+  strcpy (username, field_buffer (g_login_field[0], 0));
+  strcpy (password, field_buffer (g_login_field[1], 0));
   trim (username);
   trim (password);
 
-  /* Un post form and free the memory */
-  unpost_form (form);
-  free_form (form);
-
+  trace_async_begin ("login", g_session);
   sp_session_login (g_session, username, password, true, NULL);
 
-  free_field (field[0]);
-  free_field (field[1]);
-
-  transition_to (STATUS_LOGGING_IN);
-  msg_to_user ("logging in..");
-
-  curs_set (0);
-
-  return 0;
+  return STATUS_LOGGING_IN;
 }
 
 static int
@@ -324,291 +521,925 @@ automatic_login ()
 
   fclose (in);
 
+  trace_async_begin ("login", g_session);
   sp_session_login (g_session, name, NULL, true, blob);
-  transition_to (STATUS_LOGGING_IN);
-
-  return 0;
+  return STATUS_LOGGING_IN;
 
  fail:
   if (in)
     fclose (in);
-  transition_to (STATUS_LOGIN);
-  return 0;
+  return STATUS_LOGIN;
+}
+
+/* Startup timeline: the time every phase ended, from the start of
+   main.  It is shown with -d once the home menu is reached.  */
+static long long g_startup_start;
+static char g_startup[256];
+static bool g_startup_done;
+
+static void
+startup_mark (const char *phase)
+{
+  size_t len = strlen (g_startup);
+
+  if (g_startup_done)
+    return;
+
+  snprintf (g_startup + len, sizeof g_startup - len, "%s%s %lldms",
+            len ? ", " : "startup: ", phase, now_ms () - g_startup_start);
 }
 
 static int
 logging_in ()
 {
-  usleep (250 * 1000);
+  if (g_status_entered)
+    msg_to_user ("logging in..");
+  return 0;
 }
 
-void
-search_complete (sp_search *result, void *userdata)
+static void
+search_results_arrived (struct search_result *sr, size_t at, void *data)
 {
+  struct result_list *l = &g_browse_list;
+  struct search_result *copy;
+  size_t n = 0, shown = 0;
+
+  while (sr[n].type)
+    n++;
+  while (at && g_search_results && g_search_results[shown].type)
+    shown++;
+
+  /* A page is only useful right after the rows shown.  */
+  copy = NULL;
+  if (at == shown)
+    copy = arena_alloc (list_arena (l), (at + n + 1) * sizeof *sr);
+  if (copy == NULL)
+    {
+      free_search_results (sr);
+      free (sr);
+      return;
+    }
+
+  /* The references of the rows kept move to the new array.  */
+  if (at)
+    memcpy (copy, g_search_results, at * sizeof *sr);
+  memcpy (copy + at, sr, n * sizeof *sr);
+  free (sr);
+
+  if (at)
+    {
+      g_search_results = copy;
+      list_extend (l, copy);
+      return;
+    }
+
+  list_remember (l);
+  free_search_results (g_search_results);
+  list_reset_links (l);
+  g_search_results = copy;
+  list_set_results (l, copy, true);
 }
 
 static int
-search_album ()
+new_search (const char *query, int categories, int count)
 {
-  char buffer[64];
-  if (read_line (buffer, sizeof (buffer), "Album: "))
+  set_search_results (NULL, NULL);
+  if (search_start (g_session, query, categories, count,
+                    search_results_arrived, NULL) < 0)
     return STATUS_HOME;
+  search_keep ();
 
-  if (g_search)
-    sp_search_release (g_search);
-
-  g_search = sp_search_create (g_session, buffer, 0, 0, 0, 50,
-			       0, 0, 0, 0, SP_SEARCH_STANDARD,
-			       search_complete, g_search);
+  if (g_debug)
+    {
+      char buffer[80];
+      unsigned long hits, misses;
+      cache_stats (&hits, &misses);
+      snprintf (buffer, sizeof buffer, "search cache: %lu hits, %lu misses",
+                hits, misses);
+      msg_to_user (buffer);
+    }
 
   return STATUS_SEARCH_BROWSE;
 }
 
+/* Incremental search: the query is sent once the user stops typing for
+   SEARCH_DEBOUNCE_MS, and the results are shown below the prompt.  */
+static char g_input[64];
+static size_t g_input_len;
+static const char *g_input_prompt;
+static int g_input_categories;
+static long long g_input_changed;
+/* When the query shown was sent, until it is kept in the cache.  */
+static long long g_input_sent;
+
 static int
-search_artist ()
+incremental_search (const char *prompt, int categories)
 {
-  char buffer[64];
-  if (read_line (buffer, sizeof (buffer), "Artist: "))
-    return STATUS_HOME;
+  g_input[0] = '\0';
+  g_input_len = 0;
+  g_input_prompt = prompt;
+  g_input_categories = categories;
+  g_input_changed = 0;
+  g_input_sent = 0;
+
+  set_search_results (NULL, NULL);
+  return STATUS_SEARCH_INPUT;
+}
 
-  if (g_search)
-    sp_search_release (g_search);
+static int
+search_input (int c)
+{
+  struct result_list *l = &g_browse_list;
+  size_t prompt_len = strlen (g_input_prompt);
 
-  g_search = sp_search_create (g_session, buffer, 0, 0, 0, 0,
-			       0, 50, 0, 0, SP_SEARCH_STANDARD,
-			       search_complete, g_search);
+  switch (c)
+    {
+    case 27:
+      search_cancel ();
+      return STATUS_HOME;
+
+    case '\n':
+    case KEY_DOWN:
+      if (g_input_sent)
+        search_keep ();
+      g_input_sent = 0;
+      if (g_search_results && g_search_results[0].type)
+        return STATUS_BROWSE_SHOW;
+      break;
 
-  return STATUS_SEARCH_BROWSE;
+    default:
+      if (edit_line (g_input, sizeof g_input, &g_input_len, c))
+        {
+          g_input_changed = now_ms ();
+          g_input_sent = 0;
+        }
+      break;
+    }
+
+  if (g_input_sent && now_ms () - g_input_sent >= SEARCH_DWELL_MS)
+    {
+      search_keep ();
+      g_input_sent = 0;
+    }
+
+  /* A newer query supersedes the ones still in flight.  The local
+     index answers at once.  */
+  if (g_input_changed && (g_input_categories == SEARCH_LIBRARY
+                          || now_ms () - g_input_changed >= SEARCH_DEBOUNCE_MS))
+    {
+      g_input_changed = 0;
+      g_input_sent = 0;
+      if (g_input_len == 0)
+        set_search_results (NULL, NULL);
+      else if (g_input_categories == SEARCH_LIBRARY)
+        set_search_results (library_search (g_input,
+                                             list_arena (&g_browse_list),
+                                             LIBRARY_MAX_RESULTS), NULL);
+      else if (search_start (g_session, g_input, g_input_categories, 50,
+                             search_results_arrived, NULL) == 0)
+        g_input_sent = now_ms ();
+    }
+
+  l->top = 2;
+  list_process (l, ERR);
+  if (list_near_end (l))
+    search_more ();
+
+  attrset (COLOR_PAIR (COLOR_INPUT));
+  mvaddnstr (1, 1, g_input_prompt, g_w - 2);
+  mvaddnstr (1, prompt_len + 1, g_input, g_w - 2 - prompt_len);
+  mvhline (1, prompt_len + g_input_len + 1, ' ',
+           g_w - 2 - prompt_len - g_input_len);
+  attrset (COLOR_PAIR (COLOR_DEFAULT));
+  curs_set (1);
+  move (1, prompt_len + g_input_len + 1);
+
+  return 0;
 }
 
 static int
-search_playlist ()
+search_all ()
 {
-  char buffer[64];
-  if (read_line (buffer, sizeof (buffer), "Playlist: "))
-    return STATUS_HOME;
-
-  if (g_search)
-    sp_search_release (g_search);
+  return incremental_search ("Search: ", SEARCH_ALL);
+}
 
-  g_search = sp_search_create (g_session, buffer, 0, 0, 0, 0,
-			       0, 0, 0, 50, SP_SEARCH_STANDARD,
-			       search_complete, g_search);
+static int
+search_library ()
+{
+  return incremental_search ("Library: ", SEARCH_LIBRARY);
+}
 
-  return STATUS_SEARCH_BROWSE;
+static int
+search_album ()
+{
+  return incremental_search ("Album: ", SEARCH_ALBUMS);
 }
 
 static int
-whats_new ()
+search_artist ()
 {
-  if (g_search)
-    sp_search_release (g_search);
+  return incremental_search ("Artist: ", SEARCH_ARTISTS);
+}
 
-  g_search = sp_search_create (g_session, "tag:new", 0, 15, 0, 15,
-			       0, 15, 0, 15, SP_SEARCH_STANDARD,
-			       search_complete, g_search);
+static int
+search_playlist ()
+{
+  return incremental_search ("Playlist: ", SEARCH_PLAYLISTS);
+}
 
-  return STATUS_SEARCH_BROWSE;
+static int
+whats_new ()
+{
+  return new_search ("tag:new", SEARCH_ALL, 15);
 }
 
+/* The request shown by the loading screen, and the status to go to
+   once it completes.  */
+static struct load_request *g_loading;
+static int g_loading_next;
+
 static int
-starred ()
+wait_load (struct load_request *req)
 {
-  int i, ret;
-  sp_playlist *starred = sp_session_starred_create (g_session);
-  time_t start = time (NULL);
-  if (starred == NULL)
+  if (req == NULL)
     return STATUS_HOME;
 
-  while (!sp_playlist_is_loaded (starred))
-    {
-      int to;
-      sp_session_process_events (g_session, &to);
-      if (time (NULL) - start > TIMEOUT)
-	{
-	  sp_playlist_release (starred);
-	  return STATUS_HOME;
-	}
-      usleep (min (to, 250) * 1000);
-    }
+  g_loading = req;
+  g_loading_next = STATUS_HOME;
+  return STATUS_LOADING;
+}
+
+/* Called by the load callbacks of the foreground request.  */
+static void
+load_done (int next_status, sp_error error)
+{
+  g_loading = NULL;
+  g_loading_next = next_status;
 
-  ret = sp_playlist_num_tracks (starred);
+  if (error == LOAD_ERROR_TIMEOUT)
+    msg_to_user ("Timeout");
+  else if (error != SP_ERROR_OK)
+    msg_to_user (sp_error_message (error));
+}
 
-  free_search_results (g_search_results);
-  g_search_results = calloc ((ret + 1) * sizeof (struct search_result), 1);
-  for (i = 0; i < ret; i++)
+static int
+show_loading (int c)
+{
+  char buffer[64];
+
+  if (g_loading == NULL)
+    return g_loading_next;
+
+  if (c == 27)
     {
-      g_search_results[i].type = TYPE_TRACK;
-      g_search_results[i].track = sp_playlist_track (starred, i);
-      sp_track_add_ref (g_search_results[i].track);
+      load_cancel (g_loading);
+      g_loading = NULL;
+      return STATUS_HOME;
     }
 
-  sp_playlist_release (starred);
-  return STATUS_BROWSE_SHOW;
+  load_describe (g_loading, buffer, sizeof buffer);
+  msg_to_user (buffer);
+  return 0;
 }
 
-static struct search_result *
-playlists ()
+/* Tracks of a playlist still to be added to the browse list.  They are
+   filled a chunk per iteration of the main loop, so that the first rows
+   show up at once whatever the size of the playlist.  */
+static struct
 {
-  int i, n_playlists;
-  time_t start = time (NULL);
-  struct search_result *res;
-  sp_playlistcontainer *pc = sp_session_playlistcontainer (g_session);
-  if (pc == NULL)
-    return NULL;
-  while (!sp_playlistcontainer_is_loaded (pc))
-    {
-      int to;
-      sp_session_process_events (g_session, &to);
-      if (time (NULL) - start > TIMEOUT)
-        return NULL;
-      usleep (min (to, 250) * 1000);
-    }
+  sp_playlist *playlist;
+  struct search_result *sr;
+  int next;
+  int count;
+} g_fill;
 
-  n_playlists = sp_playlistcontainer_num_playlists (pc);
+static void
+fill_stop ()
+{
+  if (g_fill.playlist)
+    sp_playlist_release (g_fill.playlist);
+  g_fill.playlist = NULL;
+  g_fill.sr = NULL;
+}
 
-  res = calloc ((n_playlists + 1) * sizeof (struct search_result), 1);
+static void
+fill_rows (int n)
+{
+  int want = min (g_fill.next + n, g_fill.count);
+  /* The playlist may have shrunk in the meantime.  */
+  int end = min (want, sp_playlist_num_tracks (g_fill.playlist));
 
-  for (i = 0; i < n_playlists; i++)
+  for (; g_fill.next < end; g_fill.next++)
     {
-      sp_playlist *pl;
-      switch (sp_playlistcontainer_playlist_type (pc, i))
-	{
+      struct search_result *sr = &g_fill.sr[g_fill.next];
+      sr->track = sp_playlist_track (g_fill.playlist, g_fill.next);
+      sp_track_add_ref (sr->track);
+      sr->type = TYPE_TRACK;
+    }
 
-	case SP_PLAYLIST_TYPE_PLAYLIST:
-	  pl = sp_playlistcontainer_playlist (pc, i);
-	  sp_playlist_add_ref (pl);
+  if (g_fill.next >= g_fill.count || end < want)
+    fill_stop ();
+}
 
-	  res[i].type = TYPE_PLAYLIST;
-	  res[i].playlist = pl;
-	  break;
+static void
+fill_process ()
+{
+  if (g_fill.playlist == NULL)
+    return;
 
-	case SP_PLAYLIST_TYPE_START_FOLDER:
-	  sp_playlistcontainer_playlist_folder_name (pc, i,
-						     res
-						     [i].folder,
-						     sizeof (res[i].folder));
-	  res[i].type = TYPE_PLAYLISTCONTAINER_START;
-	  break;
+  fill_rows (FILL_CHUNK);
+  list_grow (&g_browse_list);
+}
 
-	case SP_PLAYLIST_TYPE_END_FOLDER:
-	  res[i].type = TYPE_PLAYLISTCONTAINER_END;
-	  break;
-	}
-    }
+/* Fill what is left, e.g. before the tracks are queued.  */
+static void
+fill_finish ()
+{
+  if (g_fill.playlist == NULL)
+    return;
 
-  return res;
+  fill_rows (g_fill.count);
+  list_grow (&g_browse_list);
 }
 
+/* Show the tracks of PL, BROWSED is the playlist the user browses if
+   any.  */
 static int
-playlists_handler ()
+show_playlist_tracks (sp_playlist *pl, sp_playlist *browsed)
 {
-  struct search_result *sr = playlists ();
+  struct search_result *sr;
+  int n = sp_playlist_num_tracks (pl);
+
+  sr = arena_alloc (list_arena (&g_browse_list), (n + 1) * sizeof *sr);
   if (sr == NULL)
-    return STATUS_HOME;
+    return -1;
 
-  free_search_results (g_search_results);
-  g_search_results = sr;
+  set_search_results (sr, browsed);
+
+  g_fill.playlist = pl;
+  sp_playlist_add_ref (pl);
+  g_fill.sr = sr;
+  g_fill.next = 0;
+  g_fill.count = n;
+  g_browse_list.capacity = n;
+  fill_rows (max (g_h, FILL_CHUNK));
+  return 0;
+}
 
-  return STATUS_BROWSE_SHOW_PLAYLISTS;
+static void
+starred_loaded (void *object, sp_error error, void *data)
+{
+  if (error != SP_ERROR_OK)
+    {
+      load_done (STATUS_HOME, error);
+      return;
+    }
+
+  if (show_playlist_tracks (object, NULL) < 0)
+    error = SP_ERROR_OTHER_TRANSIENT;
+  load_done (error == SP_ERROR_OK ? STATUS_BROWSE_SHOW : STATUS_HOME, error);
 }
 
 static int
-exit_application ()
+starred ()
 {
-  sp_session_logout (g_session);
-  sp_session_player_play (g_session, false);
-  delwin (content_wnd);
-  delwin (g_mainwin);
-  endwin ();
-  sound_clean ();
-  _exit (0);
+  struct load_request *req;
+  sp_playlist *starred = sp_session_starred_create (g_session);
+  if (starred == NULL)
+    return STATUS_HOME;
+
+  req = load_playlist (starred, TIMEOUT * 1000, starred_loaded, NULL);
+  sp_playlist_release (starred);
+  return wait_load (req);
 }
 
+/* Show the rows of the container model in the browse list.  */
 static void
-atexit_cleanup ()
+show_playlists ()
 {
-  exit_application ();
+  set_search_results (NULL, NULL);
+  g_search_results = list_share_container (&g_browse_list, false);
 }
 
-static int
-show_playing ()
+/* DATA is the status to go to, either the playlists screen or the
+   playlist picker.  */
+static void
+playlists_loaded (void *object, sp_error error, void *data)
 {
-  int tmp, off;
-  sp_track *last_showed_track = NULL;
-  sp_error err;
+  int next_status = (intptr_t) data;
 
-  do
+  if (error != SP_ERROR_OK)
     {
-      g_current_track = queue_get_next (g_play_queue);
-      if (g_current_track == NULL)
-        {
-          transition_to (STATUS_HOME);
-          return 0;
-        }
-
-      err = sp_session_player_load (g_session, g_current_track);
+      load_done (next_status == STATUS_CHOOSE_PLAYLIST
+                 ? g_picker_return : STATUS_HOME, error);
+      return;
     }
-  while (err == SP_ERROR_TRACK_NOT_PLAYABLE);
 
-  sp_session_player_play (g_session, true);
-  g_paused = 0;
-  g_elapsed_frames = 0;
+  if (next_status == STATUS_BROWSE_SHOW_PLAYLISTS)
+    show_playlists ();
 
-  while (1)
-    {
-      int to, c, skip_track = 0;
-      sp_track *to_star[1];
+  load_done (next_status, error);
+}
 
-      if (last_showed_track != g_current_track || force_redraw)
-	{
-	  sp_album *album = sp_track_album (g_current_track);
-	  const byte *data = sp_album_cover (album, SP_IMAGE_SIZE_NORMAL);
-	  if (data)
-            {
-              sp_image *i = sp_image_create (g_session, data);
-              if (sp_image_is_loaded (i))
-                {
-                  FILE *memstream;
-                  size_t l;
-                  data = sp_image_data (i, &l);
-                  memstream = fmemopen ((char *) data, l, "rb");
-                  img_show_art (memstream);
-                  fclose (memstream);
-                  last_showed_track = g_current_track;
-                  force_redraw = false;
-                }
+static int
+load_playlists (int next_status)
+{
+  sp_playlistcontainer *pc = sp_session_playlistcontainer (g_session);
+  if (pc == NULL)
+    return STATUS_HOME;
+
+  /* The model is up to date once the container is loaded.  */
+  if (container_rows ())
+    {
+      if (next_status == STATUS_BROWSE_SHOW_PLAYLISTS)
+        show_playlists ();
+      return next_status;
+    }
+
+  return wait_load (load_container (pc, TIMEOUT * 1000, playlists_loaded,
+                                    (void *) (intptr_t) next_status));
+}
+
+static int
+playlists_handler ()
+{
+  return load_playlists (STATUS_BROWSE_SHOW_PLAYLISTS);
+}
+
+static void
+artistbrowse_loaded (void *object, sp_error error, void *data)
+{
+  sp_artistbrowse *arb = object;
+  struct search_result *sr;
+  size_t ret, i, j;
+
+  if (error != SP_ERROR_OK)
+    {
+      load_done (STATUS_HOME, error);
+      return;
+    }
+
+  /* The browse has no tracks, the ones of an album are loaded when the
+     album is opened.  */
+  ret = sp_artistbrowse_num_albums (arb)
+    + sp_artistbrowse_num_tophit_tracks (arb);
+
+  sr = arena_alloc (list_arena (&g_browse_list),
+                    (ret + 1) * sizeof (struct search_result));
+  if (sr == NULL)
+    {
+      load_done (STATUS_HOME, SP_ERROR_OTHER_TRANSIENT);
+      return;
+    }
+
+  i = 0;
+  for (j = 0; j < sp_artistbrowse_num_albums (arb); j++)
+    {
+      sr[i].type = TYPE_ALBUM;
+      sr[i].album = sp_artistbrowse_album (arb, j);
+      sp_album_add_ref (sr[i++].album);
+    }
+
+  for (j = 0; j < sp_artistbrowse_num_tophit_tracks (arb); j++)
+    {
+      sr[i].type = TYPE_TRACK;
+      sr[i].track = sp_artistbrowse_tophit_track (arb, j);
+      sp_track_add_ref (sr[i++].track);
+    }
+
+  set_search_results (sr, NULL);
+  load_done (STATUS_BROWSE_SHOW, error);
+}
+
+static void
+albumbrowse_loaded (void *object, sp_error error, void *data)
+{
+  sp_albumbrowse *alb = object;
+  struct search_result *sr;
+  size_t ret, i;
+
+  if (error != SP_ERROR_OK)
+    {
+      load_done (STATUS_HOME, error);
+      return;
+    }
+
+  ret = sp_albumbrowse_num_tracks (alb);
+
+  sr = arena_alloc (list_arena (&g_browse_list),
+                    (ret + 1) * sizeof (struct search_result));
+  if (sr == NULL)
+    {
+      load_done (STATUS_HOME, SP_ERROR_OTHER_TRANSIENT);
+      return;
+    }
+
+  for (i = 0; i < ret; i++)
+    {
+      sr[i].type = TYPE_TRACK;
+      sr[i].track = sp_albumbrowse_track (alb, i);
+      sp_track_add_ref (sr[i].track);
+    }
+
+  set_search_results (sr, NULL);
+  load_done (STATUS_BROWSE_SHOW, error);
+}
+
+static void
+playlist_loaded (void *object, sp_error error, void *data)
+{
+  if (error != SP_ERROR_OK)
+    {
+      load_done (STATUS_HOME, error);
+      return;
+    }
+
+  /*FIXME: keep the whole sr, not just playlist.  */
+  if (show_playlist_tracks (object, object) < 0)
+    error = SP_ERROR_OTHER_TRANSIENT;
+  load_done (error == SP_ERROR_OK ? STATUS_BROWSE_SHOW : STATUS_HOME, error);
+}
+
+static int
+browse (struct search_result *sr)
+{
+  struct load_request *req;
+  load_cb cb;
+  void *object;
+
+  switch (sr->type)
+    {
+    case TYPE_ARTIST:
+      cb = artistbrowse_loaded;
+      break;
+
+    case TYPE_ALBUM:
+      cb = albumbrowse_loaded;
+      break;
+
+    case TYPE_PLAYLIST:
+      cb = playlist_loaded;
+      break;
+
+    default:
+      return 0;
+    }
+
+  /* Prefetched while the cursor was resting on it.  */
+  object = prefetch_lookup (sr);
+  if (object)
+    {
+      cb (object, SP_ERROR_OK, NULL);
+      return g_loading_next;
+    }
+
+  req = prefetch_adopt (sr, cb, NULL);
+  if (req)
+    return wait_load (req);
+
+  switch (sr->type)
+    {
+    case TYPE_ARTIST:
+      req = load_artistbrowse (g_session, sr->artist, SP_ARTISTBROWSE_NO_TRACKS,
+                               TIMEOUT * 1000, cb, NULL);
+      break;
+
+    case TYPE_ALBUM:
+      req = load_albumbrowse (g_session, sr->album, TIMEOUT * 1000, cb, NULL);
+      break;
+
+    case TYPE_PLAYLIST:
+      req = load_playlist (sr->playlist, TIMEOUT * 1000, cb, NULL);
+      break;
+    }
+
+  return wait_load (req);
+}
+
+/* The status the atexit handler ends with, set by quit.  */
+static int g_exit_status = EXIT_SUCCESS;
+
+static void
+cleanup ()
+{
+  cache_save ();
+  list_remember (&g_browse_list);
+  list_remember (&g_picker_list);
+  meta_save ();
+  library_stop ();
+  sp_session_logout (g_session);
+  sp_session_player_play (g_session, false);
+  control_stop ();
+  trace_stop ();
+  if (g_mainwin)
+    {
+      delwin (content_wnd);
+      delwin (g_mainwin);
+      endwin ();
+    }
+  sound_clean ();
+}
+
+static int
+exit_application ()
+{
+  cleanup ();
+  _exit (0);
+}
+
+/* The libspotify threads are not waited for, the process ends here.
+   What is left in stdout, as the output of --export, is written
+   first.  */
+static void
+atexit_cleanup ()
+{
+  cleanup ();
+  fflush (NULL);
+  _exit (g_exit_status);
+}
+
+/* Exit with STATUS once atexit_cleanup is registered.  */
+static void
+quit (int status)
+{
+  g_exit_status = status;
+  exit (status);
+}
+
+static int
+track_link (sp_track *track, char *buffer, int len)
+{
+  struct search_result sr;
+
+  sr.type = TYPE_TRACK;
+  sr.track = track;
+  return search_result_link (&sr, buffer, len);
+}
+
+static void
+player_pause (int paused)
+{
+  g_paused = paused;
+  sound_pause (g_paused);
+  sp_session_player_play (g_session, !g_paused);
+  control_event (g_paused ? "paused" : "resumed");
+}
+
+static void
+player_seek (int seconds)
+{
+  int frames;
+
+  if (g_current_track == NULL || g_sample_rate == 0)
+    return;
+
+  frames = max (g_elapsed_frames + seconds * g_sample_rate, 0);
+  g_seek_off = frames / g_sample_rate * 1000;
+  assert (g_seek_off >= 0);
+
+  g_paused = false;
+  sound_pause (g_paused);
+
+  sp_session_player_play (g_session, false);
+  sp_session_player_seek (g_session, g_seek_off);
+  sp_session_player_play (g_session, true);
+}
+
+static void
+player_stop ()
+{
+  sp_session_player_play (g_session, false);
+  if (g_current_track)
+    {
+      sp_session_player_unload (g_session);
+      sp_track_release (g_current_track);
+      g_current_track = NULL;
+    }
+  g_end_of_track = 0;
+}
+
+/* Load and start the next playable track in the queue.  Return false
+   when the queue is exhausted.  */
+static bool
+player_next ()
+{
+  char buffer[256];
+  sp_error err;
+
+  player_stop ();
+  do
+    {
+      g_current_track = queue_get_next (g_play_queue);
+      if (g_current_track == NULL)
+        return false;
+
+      err = sp_session_player_load (g_session, g_current_track);
+      if (err == SP_ERROR_TRACK_NOT_PLAYABLE)
+        {
+          sp_track_release (g_current_track);
+          g_current_track = NULL;
+        }
+    }
+  while (err == SP_ERROR_TRACK_NOT_PLAYABLE);
+
+  g_elapsed_frames = 0;
+  g_paused = 0;
+  sound_pause (g_paused);
+  sp_session_player_play (g_session, true);
+
+  if (track_link (g_current_track, buffer, sizeof buffer) == 0)
+    control_event ("track %s", buffer);
+  return true;
+}
+
+/* Advance the playback independently of the screen shown.  */
+static void
+player_process ()
+{
+  static bool sound_reported;
+  const char *error = sound_error ();
+
+  if (error && !sound_reported)
+    {
+      char buffer[128];
+      snprintf (buffer, sizeof buffer, "Cannot open the sound device: %s",
+                error);
+      msg_to_user (buffer);
+      sound_reported = true;
+    }
+
+  if (!g_end_of_track)
+    return;
+
+  g_end_of_track = 0;
+  if (!player_next ())
+    {
+      msg_to_user ("End of the play queue");
+      control_event ("end");
+    }
+}
+
+/* Keys controlling the playback from any screen.  Return the next
+   status, or 0.  */
+static int
+player_key (int c)
+{
+  switch (c)
+    {
+    case ' ':
+      if (g_current_track)
+        player_pause (!g_paused);
+      break;
+
+    case 'p':
+      if (g_current_track && g_status != STATUS_PLAYING)
+        return STATUS_PLAYING;
+      break;
+    }
+
+  return 0;
+}
+
+/* The now-playing line, drawn over the bottom border of every screen.  */
+/* The elapsed time is shown in steps of this many seconds.  */
+static int
+progress_step ()
+{
+  return frame_low_bandwidth () ? FRAME_PROGRESS_STEP_LOW : 1;
+}
+
+static void
+draw_status_line ()
+{
+  static char drawn[256], drawn_counter[32];
+  static unsigned long drawn_screen;
+  static int drawn_w;
+  char buffer[256], counter[32];
+  const char *artist_name = "";
+  sp_artist *artist;
+  int elapsed_seconds, duration_seconds;
+
+  buffer[0] = '\0';
+  if (g_current_track && g_w >= 8)
+    {
+      artist = sp_track_artist (g_current_track, 0);
+      if (artist && sp_artist_is_loaded (artist))
+        artist_name = sp_artist_name (artist);
+
+      elapsed_seconds = g_sample_rate ? g_elapsed_frames / g_sample_rate : 0;
+      elapsed_seconds -= elapsed_seconds % progress_step ();
+      duration_seconds = sp_track_duration (g_current_track) / 1000;
+
+      snprintf (buffer, sizeof buffer, " %s %s - %s [%.2i:%.2i/%.2i:%.2i] ",
+                g_paused ? "||" : ">", sp_track_name (g_current_track),
+                artist_name, elapsed_seconds / 60, elapsed_seconds % 60,
+                duration_seconds / 60, duration_seconds % 60);
+    }
+
+  counter[0] = '\0';
+  if (g_debug)
+    snprintf (counter, sizeof counter, " tty %lluK ",
+              frame_tty_bytes () / 1024);
+
+  /* Most of the times nothing changed since the last call.  */
+  if (drawn_screen == g_screen_generation && drawn_w == g_w
+      && strcmp (drawn, buffer) == 0 && strcmp (drawn_counter, counter) == 0)
+    return;
+
+  strcpy (drawn, buffer);
+  strcpy (drawn_counter, counter);
+  drawn_screen = g_screen_generation;
+  drawn_w = g_w;
+
+  attrset (COLOR_PAIR (COLOR_DEFAULT));
+  mvhline (g_h - 1, 1, ACS_HLINE, g_w - 2);
+  if (buffer[0])
+    mvaddnstr (g_h - 1, 2, buffer, g_w - 4);
+  if (counter[0] && g_w > (int) (strlen (buffer) + strlen (counter)) + 4)
+    mvaddstr (g_h - 1, g_w - 2 - strlen (counter), counter);
+}
+
+static int
+show_playing (int c)
+{
+  if (g_current_track == NULL)
+    return STATUS_HOME;
+
+  if (g_shown_track != g_current_track)
+    {
+      reset_screen ();
+      g_shown_track = g_current_track;
+      force_redraw = true;
+    }
+
+  if (force_redraw)
+    {
+      sp_album *album = sp_track_album (g_current_track);
+      const byte *data = sp_album_cover (album, SP_IMAGE_SIZE_NORMAL);
+
+      if (data)
+        {
+          sp_image *i = sp_image_create (g_session, data);
+          if (sp_image_is_loaded (i))
+            {
+              FILE *memstream;
+              size_t l;
+              data = sp_image_data (i, &l);
+              memstream = fmemopen ((char *) data, l, "rb");
+              /* Over a slow link, the art gets what a second of
+                 frames may send.  */
+              img_show_art (memstream, frame_budget () * FRAME_RATE_LOW
+                            / IMG_BYTES_PER_CELL);
+              fclose (memstream);
+              force_redraw = false;
             }
-	}
-      sp_session_process_events (g_session, &to);
+          sp_image_release (i);
+        }
+    }
 
-      if (g_sample_rate)
-	{
-	  int i, bar_len, elapsed_seconds, duration_seconds;
-          sp_artist *artist;
-          const char *tmp;
-	  elapsed_seconds = g_elapsed_frames / g_sample_rate;
-	  duration_seconds = sp_track_duration (g_current_track) / 1000;
-	  bar_len = g_w - 2 * (3 + 6);
+  if (g_sample_rate)
+    {
+      static unsigned long drawn_screen, drawn_stars;
+      static int drawn_second = -1, drawn_bar_len;
+      bool new_screen = drawn_screen != g_screen_generation;
+      int i, bar_len, elapsed_seconds, duration_seconds;
+      sp_artist *artist;
+      const char *tmp;
+      elapsed_seconds = g_elapsed_frames / g_sample_rate;
+      duration_seconds = max (sp_track_duration (g_current_track) / 1000, 1);
+      elapsed_seconds = min (elapsed_seconds, duration_seconds);
+      elapsed_seconds -= elapsed_seconds % progress_step ();
+      bar_len = g_w - 2 * (3 + 6);
+
+      /* The bar only changes with the second shown.  */
+      if (new_screen || elapsed_seconds != drawn_second
+          || bar_len != drawn_bar_len)
+        {
+          attrset (COLOR_PAIR (COLOR_SEEK_BAR_ELAPSED));
+          mvhline (g_h - 4, 3 + 6, '*', bar_len * elapsed_seconds / duration_seconds);
 
-	  attrset (COLOR_PAIR (COLOR_SEEK_BAR_ELAPSED));
-	  mvhline (g_h - 4, 3 + 6, '*', bar_len * elapsed_seconds / duration_seconds);
+          attrset (COLOR_PAIR (COLOR_SEEK_BAR_FUTURE));
+          mvhline (g_h - 4, 3 + 6 + bar_len * elapsed_seconds / duration_seconds, '*',
+                   bar_len * (duration_seconds - elapsed_seconds) / duration_seconds);
 
-	  attrset (COLOR_PAIR (COLOR_SEEK_BAR_FUTURE));
-	  mvhline (g_h - 4, 3 + 6 + bar_len * elapsed_seconds / duration_seconds, '*',
-		   bar_len * (duration_seconds - elapsed_seconds) / duration_seconds);
 
+          attrset (COLOR_PAIR (COLOR_DEFAULT));
+          mvprintw (g_h - 4, 3, "%.2i:%.2i",
+                    elapsed_seconds / 60, elapsed_seconds % 60);
+          mvprintw (g_h - 4, g_w - 3 - 6, "%.2i:%.2i",
+                    duration_seconds / 60, duration_seconds % 60);
 
-	  attrset (COLOR_PAIR (COLOR_DEFAULT));
-	  mvprintw (g_h - 4, 3, "%.2i:%.2i",
-		    elapsed_seconds / 60, elapsed_seconds % 60);
-	  mvprintw (g_h - 4, g_w - 3 - 6, "%.2i:%.2i",
-		    duration_seconds / 60, duration_seconds % 60);
+          drawn_second = elapsed_seconds;
+          drawn_bar_len = bar_len;
+        }
 
+      if (new_screen || g_force_refresh
+          || drawn_stars != starred_generation ())
+        {
           tmp = sp_track_name (g_current_track);
           i = g_w / 2 - strlen (tmp) / 2;
-	  mvprintw (g_h - 3, i, "%s", tmp);
-          print_star (g_h - 3, i - 1, sp_track_is_starred (g_session, g_current_track));
+          mvprintw (g_h - 3, i, "%s", tmp);
+          print_star (g_h - 3, i - 1, starred_contains (g_current_track));
 
           artist = sp_track_artist (g_current_track, 0);
           if (artist)
@@ -616,840 +1447,1773 @@ show_playing ()
               tmp = sp_artist_name (artist);
               mvprintw (g_h - 2, g_w / 2 - strlen (tmp) / 2, "%s", tmp);
             }
-	  move (0, 0);
-	}
 
-      nodelay (g_mainwin, true);
-      switch ((c = getch ()))
-	{
-	case KEY_LEFT:
-	  g_elapsed_frames -= 10 * g_sample_rate;
-	  if (g_elapsed_frames < 0)
-	    g_elapsed_frames = 0;
-          if (g_sample_rate)
-            g_seek_off = g_elapsed_frames / g_sample_rate * 1000;
-	  assert (g_seek_off >= 0);
-
-	  g_paused = false;
-          sound_pause (g_paused);
-
-	  sp_session_player_play (g_session, false);
-	  sp_session_player_seek (g_session, g_seek_off);
-	  sp_session_player_play (g_session, true);
-	  break;
+          g_force_refresh = 0;
+          drawn_stars = starred_generation ();
+        }
 
-	case KEY_RIGHT:
-	  tmp = g_elapsed_frames + 10 * g_sample_rate;
-          if (g_sample_rate)
-            g_seek_off = tmp / g_sample_rate * 1000;
-	  assert (g_seek_off >= 0);
+      drawn_screen = g_screen_generation;
+      move (0, 0);
+    }
 
-	  g_paused = false;
-          sound_pause (g_paused);
+  switch (c)
+    {
+    case KEY_LEFT:
+      player_seek (-10);
+      break;
+
+    case KEY_RIGHT:
+      player_seek (10);
+      break;
+
+    case KEY_DOWN:
+      if (!player_next ())
+        return STATUS_HOME;
+      break;
+
+      /* The playback goes on in the background.  */
+    case 27:
+      return STATUS_HOME;
+
+      /* Star/Unstar.  */
+    case 'u':
+    case 's':
+      starred_set (&g_current_track, 1, c == 's');
+      break;
+
+    default:
+      return player_key (c);
+    }
+
+  return 0;
+}
+
+static int
+logout ()
+{
+  player_stop ();
+  starred_stop ();
+  container_stop ();
+  import_cancel ();
+  library_stop ();
+  cache_save ();
+  meta_save ();
+  prefetch_clear ();
+  unlink ("blob.dat");
+  sp_session_forget_me (g_session);
+  sp_session_logout (g_session);
+  return STATUS_NOT_LOGGED;
+}
+
+/* PATH as typed by the user, made absolute.  */
+static void
+import_full_path (const char *path, char *buffer, size_t len)
+{
+  const char *home = getenv ("HOME");
+
+  if (path[0] == '~' && path[1] == '/' && home)
+    snprintf (buffer, len, "%s%s", home, path + 1);
+  else if (path[0] != '/' && g_start_dir)
+    snprintf (buffer, len, "%s/%s", g_start_dir, path);
+  else
+    snprintf (buffer, len, "%s", path);
+}
+
+static int
+import_links ()
+{
+  char path[PATH_MAX], where[8];
+
+  if (read_line (path, sizeof path, "File of links: ") || path[0] == '\0'
+      || read_line (where, sizeof where, "Add to the (q)ueue or a (p)laylist? "))
+    return STATUS_HOME;
+
+  import_full_path (path, g_import_path, sizeof g_import_path);
+  if (where[0] == 'p')
+    {
+      g_picker_return = STATUS_HOME;
+      return load_playlists (STATUS_CHOOSE_PLAYLIST);
+    }
+
+  if (where[0] == 'q'
+      && import_start (g_session, g_import_path, NULL, g_play_queue) < 0)
+    msg_to_user ("Cannot read the file");
+  g_import_path[0] = '\0';
+  return STATUS_HOME;
+}
+
+/* Show how the import goes every second, and its summary.  */
+static void
+import_report ()
+{
+  static long long last;
+  char buffer[128];
+  bool done;
+
+  if (import_progress (buffer, sizeof buffer, &done) < 0
+      || (!done && now_ms () - last < 1000))
+    return;
+
+  last = now_ms ();
+  msg_to_user (buffer);
+}
+
+static struct
+{
+  const char *name;
+  int (*handler) ();
+} g_menu_choices[] =
+  {
+    {
+      "Search", search_all},
+    {
+      "Search Library", search_library},
+    {
+      "Search Album", search_album},
+    {
+      "Search Artist", search_artist},
+    {
+      "Search Playlist", search_playlist},
+    {
+      "What's new", whats_new},
+    {
+      "Starred", starred},
+    {
+      "Playlists", playlists_handler},
+    {
+      "Import Links", import_links},
+    {
+      "Logout", logout},
+    {
+      "Exit", exit_application}};
+
+static MENU *g_home_menu;
+static ITEM **g_home_items;
+static WINDOW *g_home_wnd;
+static int g_home_selected;
+
+static void
+home_menu_open ()
+{
+  int i, n_choices = ARRAY_SIZE (g_menu_choices);
+
+  g_home_wnd = subwin (g_mainwin, 20, g_h - 2, 1, g_w / 2 - 10);
+  g_home_items = (ITEM **) calloc (n_choices + 1, sizeof (ITEM *));
+
+  for (i = 0; i < n_choices; ++i)
+    g_home_items[i] = new_item (g_menu_choices[i].name, g_menu_choices[i].name);
+  g_home_items[n_choices] = NULL;
+
+  g_home_menu = new_menu ((ITEM **) g_home_items);
+  menu_opts_off (g_home_menu, O_SHOWDESC);
+  set_menu_format (g_home_menu, 10, 0);
+  set_menu_mark (g_home_menu, " ");
+  set_menu_win (g_home_menu, g_home_wnd);
+  set_current_item (g_home_menu, g_home_items[g_home_selected]);
+  post_menu (g_home_menu);
+
+  wcursyncup (g_home_wnd);
+}
+
+static void
+home_menu_close ()
+{
+  int i, n_choices = ARRAY_SIZE (g_menu_choices);
+
+  if (g_home_menu == NULL)
+    return;
+
+  g_home_selected = item_index (current_item (g_home_menu));
+  unpost_menu (g_home_menu);
+  free_menu (g_home_menu);
+  for (i = 0; i < n_choices; ++i)
+    free_item (g_home_items[i]);
+  free (g_home_items);
+  delwin (g_home_wnd);
+  g_home_menu = NULL;
+}
+
+static int
+show_menu (int c)
+{
+  int selected;
+
+  if (g_home_menu == NULL)
+    home_menu_open ();
+
+  if (!g_startup_done)
+    {
+      startup_mark ("home");
+      g_startup_done = true;
+      if (g_debug)
+        msg_to_user (g_startup);
+    }
+
+  switch (c)
+    {
+    case KEY_RIGHT:
+    case '\n':
+      selected = item_index (current_item (g_home_menu));
+      return g_menu_choices[selected].handler ();
+
+    case KEY_DOWN:
+      menu_driver (g_home_menu, REQ_DOWN_ITEM);
+      break;
+
+    case KEY_UP:
+      menu_driver (g_home_menu, REQ_UP_ITEM);
+      break;
+
+    default:
+      return player_key (c);
+    }
+
+  wnoutrefresh (g_home_wnd);
+  frame_damage ();
+  return 0;
+}
+
+/* The name cached by a previous run, until the metadata is loaded.  */
+static const char *
+loading_name (struct search_result *sr)
+{
+  const char *name = meta_name (sr);
+  return name ? name : "<loading>";
+}
+
+static const char *
+search_result_get_name (struct search_result *sr)
+{
+  switch (sr->type)
+    {
+    case TYPE_ARTIST:
+      if (!sp_artist_is_loaded (sr->artist))
+	return loading_name (sr);
+      return sp_artist_name (sr->artist);
+
+    case TYPE_TRACK:
+      if (!sp_track_is_loaded (sr->track))
+	return loading_name (sr);
+      return sp_track_name (sr->track);
+
+    case TYPE_PLAYLIST:
+      if (!sp_playlist_is_loaded (sr->playlist))
+	return loading_name (sr);
+      return sp_playlist_name (sr->playlist);
+
+    case TYPE_PLAYLISTCONTAINER_START:
+      return sr->folder;
+      break;
+
+    case TYPE_PLAYLISTCONTAINER_END:
+      return " ";
+      break;
+
+    case TYPE_LINK:
+      return loading_name (sr);
+
+    case TYPE_ALBUM:
+      if (!sp_album_is_loaded (sr->album))
+	return loading_name (sr);
+      return sp_album_name (sr->album);
+    }
+
+  return NULL;
+}
+
+static void
+release_tracks_to_add ()
+{
+  int i;
+
+  for (i = 0; i < g_n_tracks_to_add; i++)
+    sp_track_release (g_tracks_to_add[i]);
+  free (g_tracks_to_add);
+  g_tracks_to_add = NULL;
+  g_n_tracks_to_add = 0;
+}
+
+/* The playlist picker adds all the N TRACKS at once.  */
+static int
+add_tracks_to_playlist (sp_track **tracks, int n)
+{
+  int i;
+
+  release_tracks_to_add ();
+  g_tracks_to_add = malloc (n * sizeof *tracks);
+  if (g_tracks_to_add == NULL)
+    return 0;
+
+  for (i = 0; i < n; i++)
+    {
+      g_tracks_to_add[i] = tracks[i];
+      sp_track_add_ref (tracks[i]);
+    }
+  g_n_tracks_to_add = n;
+  g_picker_return = g_status;
+  return load_playlists (STATUS_CHOOSE_PLAYLIST);
+}
+
+static int
+search_result_select (struct search_result *sr)
+{
+  if (sr->type == TYPE_TRACK)
+    {
+      fill_finish ();
+      list_restore (&g_browse_list, sr - g_browse_list.results,
+                    g_browse_list.size);
+      queue_play_with_future (g_play_queue, sr);
+      if (!player_next ())
+        return 0;
+      return STATUS_PLAYING;
+    }
+
+  return browse (sr);
+}
+
+/* The index in the results of the row ROW of the view.  */
+static size_t
+list_row (struct result_list *l, size_t row)
+{
+  return l->filtered ? l->filter.rows[row] : row;
+}
+
+static void
+list_draw_row (struct listview *lv, size_t row, int y, bool selected,
+               void *data)
+{
+  struct result_list *l = data;
+  struct search_result *sr;
+  const char *name;
+  char buffer[256];
+  int level = 0;
+
+  row = list_row (l, row);
+  sr = &l->results[row];
+  /* Rows given as links, e.g. by the library index, get their object
+     when they are shown.  */
+  if (sr->type == TYPE_LINK && !l->shared)
+    list_restore (l, row, row + 1);
+  name = search_result_get_name (sr);
+
+  if (sr->type == TYPE_TRACK)
+    {
+      bool starred = starred_contains (sr->track);
+      if (l->stars)
+        l->stars[row] = starred;
+      print_star (y, lv->x, starred);
+    }
+  else
+    mvaddch (y, lv->x, ' ');
+
+  if (l->drawn)
+    l->drawn[row] = name;
+  if (l->shared_levels)
+    level = l->shared_levels[row];
+  else if (l->levels)
+    level = l->levels[row];
+  snprintf (buffer, sizeof buffer, "%*s%s", level, "", name);
+
+  attrset (COLOR_PAIR (COLOR_DEFAULT) | (selected ? A_REVERSE : 0));
+  mvhline (y, lv->x + 1, ' ', lv->w - 1);
+  if (l->marks && l->marks[row])
+    mvaddch (y, lv->x + 1, '+');
+  mvaddnstr (y, lv->x + 2, buffer, lv->w - 2);
+  attrset (COLOR_PAIR (COLOR_DEFAULT));
+}
+
+/* Make room for the data of ROWS rows, keeping the one of the rows
+   already there.  */
+static int
+list_alloc_rows (struct result_list *l, size_t rows)
+{
+  unsigned char *levels = arena_alloc (&l->rows, rows);
+  const char **drawn = arena_alloc (&l->rows, rows * sizeof *drawn);
+  bool *stars = arena_alloc (&l->rows, rows * sizeof *stars);
+  bool *marks = arena_alloc (&l->rows, rows * sizeof *marks);
+
+  if (levels == NULL || drawn == NULL || stars == NULL || marks == NULL)
+    return -1;
+
+  if (l->allocated)
+    {
+      memcpy (levels, l->levels, l->size);
+      memcpy (drawn, l->drawn, l->size * sizeof *drawn);
+      memcpy (stars, l->stars, l->size * sizeof *stars);
+      memcpy (marks, l->marks, l->size * sizeof *marks);
+    }
+
+  l->levels = levels;
+  l->drawn = drawn;
+  l->stars = stars;
+  l->marks = marks;
+  l->allocated = rows;
+  return 0;
+}
+
+/* Compute the folder nesting of the rows from FROM on.  */
+static void
+list_set_levels (struct result_list *l, size_t from)
+{
+  struct search_result *sr = l->results;
+  size_t i;
+
+  for (i = from; l->levels && i < l->size; i++)
+    {
+      int level = 0;
+      if (i > 0)
+        level = l->levels[i - 1]
+          + (sr[i - 1].type == TYPE_PLAYLISTCONTAINER_START ? 1 : 0)
+          + (sr[i - 1].type == TYPE_PLAYLISTCONTAINER_END ? -1 : 0);
+      l->levels[i] = min (max (level, 0), 255);
+    }
+}
+
+static void
+list_open (struct result_list *l)
+{
+  struct search_result *sr = l->results;
+  int w = g_w < 40 ? 20 : g_w < 80 ? 40 : 60;
+  int top = max (l->top, 1);
+  size_t rows;
+  int i;
+
+  l->offset_x = g_w / 2 - w / 2 + 1;
+  l->size = 0;
+  while (sr && sr[l->size].type)
+    l->size++;
+
+  /* Leave room for the rows still to be filled.  */
+  rows = max (l->size, l->capacity);
+  l->allocated = 0;
+  l->n_marked = 0;
+  l->mark_from = 0;
+  list_alloc_rows (l, rows);
+  for (i = 0; l->marks && i < l->n_kept_marks; i++)
+    if ((size_t) l->kept_marks[i] < l->size && !l->marks[l->kept_marks[i]])
+      {
+        l->marks[l->kept_marks[i]] = true;
+        l->n_marked++;
+      }
+  list_drop_kept_marks (l);
+  l->stars_generation = starred_generation ();
+  l->reclaimed_top = 0;
+  if (!l->shared)
+    list_set_levels (l, 0);
+
+  listview_init (&l->view, top, l->offset_x - 1, g_h - 1 - top, w + 1,
+                 list_draw_row, l);
+  listview_set_count (&l->view, l->size);
+  listview_set_cursor (&l->view, max (l->selected_item, 0));
+
+  l->open = true;
+  l->stale = false;
+  l->dirty = true;
+}
+
+/* More rows of the results were filled, up to the capacity of L.  Only
+   the new rows are drawn, the cursor and the scroll position stay.  */
+static void
+list_grow (struct result_list *l)
+{
+  size_t row, old_size = l->size;
+
+  if (!l->open || l->stale)
+    return;
+
+  while (l->size < l->capacity && l->results[l->size].type)
+    l->size++;
+
+  list_set_levels (l, old_size);
+  /* The new rows are matched by the next query.  */
+  if (l->filtered)
+    return;
+  listview_set_count (&l->view, l->size);
+  for (row = old_size; row < l->size; row++)
+    listview_draw_row (&l->view, row);
+}
+
+/* The cursor is close to the last row, more rows may be wanted.  */
+static bool
+list_near_end (struct result_list *l)
+{
+  return l->open && !l->filtered
+    && l->view.cursor + SEARCH_PAGE_AHEAD >= l->size;
+}
+
+static int
+list_current (struct result_list *l)
+{
+  if (!l->open || l->view.count == 0)
+    return -1;
+
+  return list_row (l, l->view.cursor);
+}
+
+/* Record for the next start the names of the rows of L that were
+   shown, before their objects are released.  */
+static void
+list_remember (struct result_list *l)
+{
+  size_t row;
+
+  if (!l->open || l->stale || l->drawn == NULL)
+    return;
+
+  for (row = 0; row < l->size; row++)
+    if (l->drawn[row])
+      meta_remember (&l->results[row]);
+}
+
+static void
+list_close (struct result_list *l)
+{
+  if (!l->open)
+    return;
+
+  if (!l->stale)
+    l->selected_item = max (list_current (l), 0);
+
+  filter_free (&l->filter);
+  l->filtered = false;
+  l->filter_input = false;
+  l->filter_query[0] = '\0';
+  l->filter_len = 0;
+
+  arena_reset (&l->rows);
+  l->allocated = 0;
+  l->levels = NULL;
+  l->drawn = NULL;
+  l->stars = NULL;
+  l->marks = NULL;
+  l->n_marked = 0;
+  l->open = false;
+}
+
+/* Show only the rows matching the filter query, the best first.  The
+   names are taken once, when the filter is set.  */
+static void
+list_filter (struct result_list *l)
+{
+  if (!l->filtered)
+    {
+      const char **names = malloc ((l->size + 1) * sizeof *names);
+      size_t row;
+      int ret;
+
+      if (names == NULL)
+        return;
+
+      /* The reclaimed rows match with the name remembered when they
+         were released, the rows without any name yet cannot match.  */
+      for (row = 0; row < l->size; row++)
+        {
+          names[row] = search_result_get_name (&l->results[row]);
+          if (names[row] == NULL || strcmp (names[row], "<loading>") == 0)
+            names[row] = "";
+        }
+
+      ret = filter_init (&l->filter, names, l->size);
+      free (names);
+      if (ret < 0)
+        return;
+
+      l->filtered = true;
+      /* The last row of the list shows the query.  */
+      l->view.h--;
+    }
+
+  filter_apply (&l->filter, l->filter_query);
+  listview_set_count (&l->view, l->filter.n_rows);
+  listview_set_cursor (&l->view, 0);
+  l->dirty = true;
+}
+
+static void
+list_unfilter (struct result_list *l)
+{
+  int current = list_current (l);
 
-	  sp_session_player_play (g_session, false);
-	  sp_session_player_seek (g_session, g_seek_off);
-	  sp_session_player_play (g_session, true);
-	  break;
+  if (!l->filtered)
+    return;
 
-	case KEY_DOWN:
-	  skip_track = 1;
-	  break;
+  filter_free (&l->filter);
+  l->filtered = false;
+  l->filter_input = false;
+  l->filter_query[0] = '\0';
+  l->filter_len = 0;
 
-	case 27:
-	  sp_session_player_play (g_session, false);
-	  nodelay (g_mainwin, false);
-	  transition_to (STATUS_HOME);
-	  return STATUS_HOME;
+  l->view.h++;
+  listview_set_count (&l->view, l->size);
+  listview_set_cursor (&l->view, max (current, 0));
+  l->dirty = true;
+}
 
-	case ' ':
-	  g_paused = !g_paused;
-          sound_pause (g_paused);
-	  sp_session_player_play (g_session, !g_paused);
-	  break;
+static void
+list_draw_filter (struct result_list *l)
+{
+  int y = l->view.y + l->view.h;
 
-          /* Star/Unstar.  */
-        case 'u':
-        case 's':
-          to_star[0] = g_current_track;
-          sp_track_set_starred (g_session, to_star, 1, c == 's');
-          break;
-	}
-      nodelay (g_mainwin, false);
+  attrset (COLOR_PAIR (COLOR_INPUT));
+  mvhline (y, l->view.x, ' ', l->view.w);
+  mvaddch (y, l->view.x + 1, '/');
+  mvaddnstr (y, l->view.x + 2, l->filter_query, l->view.w - 2);
+  attrset (COLOR_PAIR (COLOR_DEFAULT));
+}
 
-      if (g_end_of_track || skip_track)
+/* '/' sets a filter, the keys typed next change its query until ENTER.
+   ESCAPE removes it.  Return the key if it is left to the list.  */
+static int
+list_filter_key (struct result_list *l, int c)
+{
+  if (!l->filter_input)
+    {
+      if (c == '/' && l->open && l->size)
         {
-          sp_session_player_play (g_session, false);
-          do
-            {
-              sp_track_release (g_current_track);
-              g_current_track = queue_get_next (g_play_queue);
-              if (g_current_track == NULL)
-                return STATUS_HOME;
+          l->filter_input = true;
+          list_filter (l);
+          return ERR;
+        }
 
-              err = sp_session_player_load (g_session, g_current_track);
-            }
-          while (err == SP_ERROR_TRACK_NOT_PLAYABLE);
-          g_end_of_track = 0;
-          sp_session_player_play (g_session, true);
-          reset_screen ();
-          g_elapsed_frames = 0;
+      if (c == 27 && l->filtered)
+        {
+          list_unfilter (l);
+          return ERR;
         }
 
-      usleep (min (to, 250) * 1000);
+      return c;
     }
 
-  return STATUS_HOME;
+  switch (c)
+    {
+    case 27:
+      list_unfilter (l);
+      return ERR;
+
+    case '\n':
+      l->filter_input = false;
+      return ERR;
+
+    case KEY_UP:
+    case KEY_DOWN:
+    case KEY_PPAGE:
+    case KEY_NPAGE:
+    case KEY_HOME:
+    case KEY_END:
+    case ERR:
+      return c;
+    }
+
+  if (edit_line (l->filter_query, sizeof l->filter_query, &l->filter_len, c))
+    list_filter (l);
+  return ERR;
 }
 
-static int
-logout ()
+/* The row holds a track, or held one before it was reclaimed.  */
+static bool
+list_row_is_track (struct result_list *l, size_t row)
 {
-  unlink ("blob.dat");
-  sp_session_forget_me (g_session);
-  sp_session_logout (g_session);
-  return STATUS_NOT_LOGGED;
+  struct search_result *sr = &l->results[row];
+
+  return sr->type == TYPE_TRACK
+    || (sr->type == TYPE_LINK && strncmp (sr->link, "spotify:track:", 14) == 0);
 }
 
-static int
-show_menu ()
+/* Toggle the mark of ROW or, with RANGE, mark the tracks from the
+   start of the range to ROW.  */
+static void
+list_mark (struct result_list *l, size_t row, bool range)
 {
-  struct
-  {
-    const char *name;
-    int (*handler) ();
-  } g_menu_choices[] =
-      {
-        {
-          "Search Album", search_album},
-        {
-          "Search Artist", search_artist},
-        {
-          "Search Playlist", search_playlist},
-        {
-          "What's new", whats_new},
-        {
-          "Starred", starred},
-        {
-          "Playlists", playlists_handler},
-        {
-          "Logout", logout},
-        {
-          "Exit", exit_application}};
-  int next_status;
-  MENU *menu;
-  WINDOW *list_wnd = subwin (g_mainwin, 20, g_h - 2, 1, g_w / 2 - 10);
-  int i, c;
-  static int last_selected_item = 0;
-  int n_choices = ARRAY_SIZE (g_menu_choices);
-  ITEM **items = (ITEM **) calloc (n_choices + 1, sizeof (ITEM *));
-
-  reset_screen ();
-  for (i = 0; i < n_choices; ++i)
-    items[i] = new_item (g_menu_choices[i].name, g_menu_choices[i].name);
-  items[n_choices] = NULL;
+  size_t i, from = min (l->mark_from, row), to = max (l->mark_from, row);
 
-  menu = new_menu ((ITEM **) items);
-  menu_opts_off (menu, O_SHOWDESC);
-  set_menu_format (menu, 10, 0);
-  set_menu_mark (menu, " ");
-  set_menu_win (menu, list_wnd);
-  set_current_item (menu, items[last_selected_item]);
-  post_menu (menu);
-  refresh ();
+  if (l->marks == NULL || row >= l->size)
+    return;
 
-  wcursyncup (list_wnd);
+  if (!range)
+    from = to = row;
 
-  for (;;)
+  for (i = from; i <= to && i < l->size; i++)
     {
-      c = getch ();
-      switch (c)
-	{
-        case KEY_RIGHT:
-        case '\n':
-          goto exit;
+      bool mark = range || !l->marks[i];
+      if (!list_row_is_track (l, i) || l->marks[i] == mark)
+        continue;
+      l->marks[i] = mark;
+      l->n_marked += mark ? 1 : -1;
+    }
 
-	case KEY_DOWN:
-	  menu_driver (menu, REQ_DOWN_ITEM);
-	  break;
+  l->mark_from = row;
+  l->dirty = true;
+}
 
-	case KEY_UP:
-	  menu_driver (menu, REQ_UP_ITEM);
-	  break;
-	}
+static void
+list_drop_kept_marks (struct result_list *l)
+{
+  free (l->kept_marks);
+  l->kept_marks = NULL;
+  l->n_kept_marks = 0;
+}
 
-      wrefresh (list_wnd);
-      refresh ();
+static void
+list_clear_marks (struct result_list *l)
+{
+  if (l->marks == NULL || l->n_marked == 0)
+    return;
+
+  memset (l->marks, 0, l->size * sizeof *l->marks);
+  l->n_marked = 0;
+  l->dirty = true;
+}
+
+/* Store in *ROWS and *TRACKS the marked tracks of L, or the track at
+   SELECTED when none is marked, and return how many they are.  The
+   arrays are malloc'ed, the tracks are owned by the rows.  */
+static int
+list_marked_tracks (struct result_list *l, int selected, int **rows,
+                    sp_track ***tracks)
+{
+  size_t row, first = 0, last = 0;
+  int n = 0;
+
+  if (l->n_marked == 0)
+    {
+      if (selected < 0 || l->results[selected].type != TYPE_TRACK)
+        return 0;
+      first = last = selected;
+    }
+  else
+    {
+      for (row = 0; row < l->size && !l->marks[row]; row++)
+        ;
+      first = row;
+      for (; row < l->size; row++)
+        if (l->marks[row])
+          last = row;
+      /* Marked rows far from the screen may have been reclaimed.  */
+      for (row = first; row <= last; row++)
+        if (l->marks[row])
+          list_restore (l, row, row + 1);
     }
- exit:
-  last_selected_item = item_index (current_item (menu));
-  next_status = g_menu_choices[last_selected_item].handler ();
 
-  for (i = 0; i < n_choices; ++i)
-    free_item (items[i]);
+  *rows = malloc ((last - first + 1) * sizeof **rows);
+  *tracks = malloc ((last - first + 1) * sizeof **tracks);
+  if (*rows == NULL || *tracks == NULL)
+    {
+      free (*rows);
+      free (*tracks);
+      return 0;
+    }
 
-  free_menu (menu);
-  delwin (list_wnd);
+  for (row = first; row <= last; row++)
+    if ((l->n_marked == 0 || l->marks[row])
+        && l->results[row].type == TYPE_TRACK)
+      {
+        (*rows)[n] = row;
+        (*tracks)[n++] = l->results[row].track;
+      }
 
-  if (next_status)
-    transition_to (next_status);
+  return n;
 }
 
+/* SR holds the results of L followed by new rows, they are added
+   without drawing the list again.  */
 static void
-free_search_results (struct search_result *sr)
+list_extend (struct result_list *l, struct search_result *sr)
 {
-  struct search_result *it = sr;
-  if (!sr)
-    return;
-  while (it->type != TYPE_LAST)
+  size_t n = 0;
+
+  while (sr[n].type)
+    n++;
+
+  if (!l->open || l->stale
+      || (n > l->allocated && list_alloc_rows (l, n) < 0))
     {
-      switch (it->type)
-	{
-	case TYPE_ARTIST:
-	  sp_artist_release (it->artist);
-	  break;
+      list_set_results (l, sr, true);
+      return;
+    }
 
-	case TYPE_TRACK:
-	  sp_track_release (it->track);
-	  break;
+  l->front = !l->front;
+  l->results = sr;
+  l->capacity = n;
+  list_grow (l);
+}
 
-	case TYPE_PLAYLIST:
-	  sp_playlist_release (it->playlist);
-	  break;
+/* Give back their object to the rows between FROM and TO that lost
+   it.  */
+static void
+list_restore (struct result_list *l, size_t from, size_t to)
+{
+  size_t row;
 
-	case TYPE_ALBUM:
-	  sp_album_release (it->album);
-	  break;
-	}
-      it++;
+  for (row = from; row < min (to, l->size); row++)
+    {
+      struct search_result *sr = &l->results[row], tmp;
+
+      if (sr->type == TYPE_LINK
+          && search_result_from_link (g_session, sr->link, &tmp) == 0)
+        *sr = tmp;
     }
 }
 
-static const char *
-search_result_get_name (struct search_result *sr)
+static void
+list_reset_links (struct result_list *l)
 {
-  switch (sr->type)
-    {
-    case TYPE_ARTIST:
-      if (!sp_artist_is_loaded (sr->artist))
-	return "<loading>";
-      return sp_artist_name (sr->artist);
+  arena_reset (&l->links);
+  l->reclaimed = NULL;
+  l->reclaimed_size = 0;
+}
 
-    case TYPE_TRACK:
-      if (!sp_track_is_loaded (sr->track))
-	return "<loading>";
-      return sp_track_name (sr->track);
+/* The rows around the screen when its first row is TOP.  */
+static void
+list_keep_window (struct result_list *l, size_t top, size_t *first,
+                  size_t *last)
+{
+  *first = top > LIST_KEEP_ROWS ? top - LIST_KEEP_ROWS : 0;
+  *last = min (top + l->view.h + LIST_KEEP_ROWS, l->size);
+}
 
-    case TYPE_PLAYLIST:
-      if (!sp_playlist_is_loaded (sr->playlist))
-	return "<loading>";
-      return sp_playlist_name (sr->playlist);
+/* Give the object of row ROW back to libspotify and keep only its
+   link.  */
+static void
+list_release_row (struct result_list *l, size_t row)
+{
+  struct search_result *sr = &l->results[row];
+  char buffer[256], *link;
 
-    case TYPE_PLAYLISTCONTAINER_START:
-      return sr->folder;
-      break;
+  if (sr->type == TYPE_LINK || sr->type == TYPE_PLAYLISTCONTAINER_START
+      || sr->type == TYPE_PLAYLISTCONTAINER_END)
+    return;
 
-    case TYPE_PLAYLISTCONTAINER_END:
-      return " ";
-      break;
+  if (l->reclaimed_size <= row)
+    {
+      size_t n = max (l->size, l->capacity);
+      const char **reclaimed = arena_alloc (&l->links, n * sizeof *reclaimed);
+
+      if (reclaimed == NULL)
+        return;
+      memcpy (reclaimed, l->reclaimed, l->reclaimed_size * sizeof *reclaimed);
+      memset (reclaimed + l->reclaimed_size, 0,
+              (n - l->reclaimed_size) * sizeof *reclaimed);
+      l->reclaimed = reclaimed;
+      l->reclaimed_size = n;
+    }
 
-    case TYPE_ALBUM:
-      if (!sp_album_is_loaded (sr->album))
-	return "<loading>";
-      return sp_album_name (sr->album);
+  /* A row scrolled away again keeps the link it got the first time.  */
+  if (l->reclaimed[row] == NULL)
+    {
+      if (search_result_link (sr, buffer, sizeof buffer) < 0)
+        return;
+      link = arena_alloc (&l->links, strlen (buffer) + 1);
+      if (link == NULL)
+        return;
+      strcpy (link, buffer);
+      l->reclaimed[row] = link;
     }
 
-  return NULL;
+  meta_remember (sr);
+  search_result_release (sr);
+  sr->link = l->reclaimed[row];
+  sr->type = TYPE_LINK;
 }
 
+/* Rows far from the screen give their object back to libspotify and
+   keep only its link, rows coming close to the screen get it back.
+   Only the rows entering or leaving the window around the screen since
+   the last call are touched.  */
 static void
-add_track_to_playlist (sp_track *track)
+list_reclaim (struct result_list *l)
 {
-  sp_track *tracks[1];
-  sp_playlist *pl = choose_playlist ();
-  if (pl == NULL)
+  size_t row, first, last, old_first, old_last;
+
+  if (l->view.top == l->reclaimed_top || !l->results || l->shared
+      || l->filtered)
     return;
 
-  tracks[0] = track;
-  sp_playlist_add_tracks (pl, tracks, 1, sp_playlist_num_tracks (pl), g_session);
+  list_keep_window (l, l->reclaimed_top, &old_first, &old_last);
+  list_keep_window (l, l->view.top, &first, &last);
+  l->reclaimed_top = l->view.top;
+
+  list_restore (l, first, min (last, old_first));
+  list_restore (l, max (first, old_last), last);
+
+  /* Leave some margin, not to release and get back the same rows while
+     scrolling up and down.  */
+  first = first > LIST_KEEP_ROWS ? first - LIST_KEEP_ROWS : 0;
+  last = min (last + LIST_KEEP_ROWS, l->size);
+  old_first = old_first > LIST_KEEP_ROWS ? old_first - LIST_KEEP_ROWS : 0;
+  old_last = min (old_last + LIST_KEEP_ROWS, l->size);
+
+  for (row = old_first; row < min (old_last, first); row++)
+    list_release_row (l, row);
+  for (row = max (old_first, last); row < old_last; row++)
+    list_release_row (l, row);
 }
 
-static int
-search_result_select (struct search_result *sr, struct search_result *selected)
+/* Arena for the next results of L.  Whatever it held was released when
+   it stopped being shown.  */
+static struct arena *
+list_arena (struct result_list *l)
 {
-  selected->type = TYPE_LAST;
+  struct arena *a = &l->arenas[!l->front];
+  arena_reset (a);
+  return a;
+}
 
-  if (sr->type == TYPE_TRACK)
+static void
+list_set_results (struct result_list *l, struct search_result *sr,
+                  bool keep_selection)
+{
+  if (!keep_selection)
+    l->selected_item = 0;
+  else if (l->open && !l->stale)
+    l->selected_item = max (list_current (l), 0);
+
+  /* SR was built in the arena returned by list_arena.  */
+  if (sr)
+    l->front = !l->front;
+  l->results = sr;
+  l->capacity = 0;
+  list_drop_kept_marks (l);
+  l->shared = false;
+  l->shared_levels = NULL;
+  l->stale = true;
+}
+
+/* Show the rows of the container model in L, NULL if it is not
+   loaded.  */
+static struct search_result *
+list_share_container (struct result_list *l, bool keep_selection)
+{
+  struct search_result *rows = container_rows ();
+
+  list_set_results (l, rows, keep_selection);
+  if (rows == NULL)
+    return NULL;
+
+  l->shared = true;
+  l->shared_levels = container_levels ();
+  l->shared_generation = container_generation ();
+  return rows;
+}
+
+/* Metadata arrived: draw again only the visible rows whose name is not
+   the one on the screen, e.g. a track that is not "<loading>" anymore.  */
+static void
+list_update_rows (struct result_list *l)
+{
+  size_t row, end = min (l->view.top + l->view.h, l->view.count);
+
+  if (l->drawn == NULL)
     {
-      queue_play_with_future (g_play_queue, sr);
-      return STATUS_PLAYING;
+      listview_draw (&l->view);
+      return;
     }
 
-  *selected = *sr;
+  for (row = l->view.top; row < end; row++)
+    {
+      size_t i = list_row (l, row);
+      if (search_result_get_name (&l->results[i]) != l->drawn[i])
+        listview_draw_row (&l->view, row);
+    }
+}
 
-  switch (sr->type)
+/* The starred tracks changed: draw again the stars that are not right
+   anymore, leaving the rest of the rows alone.  */
+static void
+list_update_stars (struct result_list *l)
+{
+  size_t row, end = min (l->view.top + l->view.h, l->view.count);
+
+  l->stars_generation = starred_generation ();
+  for (row = l->view.top; l->stars && row < end; row++)
     {
-    case TYPE_ARTIST:
-      sp_artist_add_ref (sr->artist);
-      break;
+      size_t i = list_row (l, row);
+      struct search_result *sr = &l->results[i];
+      bool starred;
 
-    case TYPE_PLAYLIST:
-      sp_playlist_add_ref (sr->playlist);
-      break;
+      if (sr->type != TYPE_TRACK)
+        continue;
 
-    case TYPE_ALBUM:
-      sp_album_add_ref (sr->album);
-      break;
+      starred = starred_contains (sr->track);
+      if (starred != l->stars[i])
+        {
+          l->stars[i] = starred;
+          print_star (l->view.y + (row - l->view.top), l->view.x, starred);
+        }
     }
-
-  return 0;
 }
 
-static int
-search_results_display (struct search_result *results, WINDOW *list_wnd, int offset_x,
-                        struct search_result *selected)
+/* Common handling for all the lists, called once for every iteration of
+   the main loop.  */
+static void
+list_process (struct result_list *l, int c)
 {
-  struct search_result *sr;
-  size_t size;
-  int x;
-  int y;
-  MENU *menu;
-  int i, j, c, selected_item = 0;
-  int level;
-  ITEM **items;
-  char **items_name;
-  int next_status;
-  bool is_playlists = g_status == STATUS_BROWSE_SHOW_PLAYLISTS;
+  if (!l->open || l->stale)
+    {
+      list_close (l);
+      list_open (l);
+    }
 
- restart:
-  sr = results;
-  size = 0;
-  level = 0;
-  next_status = STATUS_BROWSE_RESULT;
+  if (listview_key (&l->view, c))
+    l->dirty = true;
 
-  while (sr->type)
+  list_reclaim (l);
+
+  if (l->dirty)
     {
-      size++;
-      sr++;
+      listview_draw (&l->view);
+      if (l->filtered)
+        list_draw_filter (l);
+      l->dirty = false;
     }
+  else if (g_force_refresh)
+    list_update_rows (l);
+  g_force_refresh = 0;
+
+  if (l->stars_generation != starred_generation ())
+    list_update_stars (l);
+}
 
-  items = (ITEM **) malloc ((size + 1) * sizeof (ITEM *));
-  items_name = (char **) malloc ((size + 1) * sizeof (char *));
+static void
+set_search_results (struct search_result *sr, sp_playlist *browsed)
+{
+  fill_stop ();
+  /* Pending searches would append to the new results.  */
+  search_cancel ();
 
-  sr = results;
-  for (i = 0; i < size; ++i)
+  if (!g_browse_list.shared)
     {
-      char *name;
-      char buffer[256];
-      const char *item_name;
-      for (j = 0; j < level; j++)
-	buffer[j] = ' ';
+      list_remember (&g_browse_list);
+      free_search_results (g_search_results);
+    }
+  list_reset_links (&g_browse_list);
+  g_search_results = sr;
+
+  if (g_browsed_playlist)
+    sp_playlist_release (g_browsed_playlist);
+  g_browsed_playlist = browsed;
+  if (browsed)
+    sp_playlist_add_ref (browsed);
 
-      buffer[j] = '\0';
+  list_set_results (&g_browse_list, sr, false);
+}
 
-      level += (sr[i].type == TYPE_PLAYLISTCONTAINER_START ? 1 : 0)
-	+ (sr[i].type == TYPE_PLAYLISTCONTAINER_END ? -1 : 0);
+/* Prefetch the row the cursor rests on, forget it when it moves.  */
+static void
+hover_process (struct result_list *l, int selected_item)
+{
+  static struct search_result *hovered;
+  static long long since;
+  struct search_result *sr = NULL;
 
-      item_name = search_result_get_name (&sr[i]);
+  if (selected_item >= 0)
+    sr = &l->results[selected_item];
 
-      strncat (buffer, item_name, sizeof (buffer) - j - 1);
-      buffer[(sizeof buffer) - 1] = '\0';
-      name = strdup (buffer);
+  if (sr != hovered)
+    {
+      prefetch_cancel ();
+      hovered = sr;
+      since = now_ms ();
+      return;
+    }
 
-      items_name[i] = (char *) name;
-      items[i] = new_item (items_name[i], items_name[i]);
+  if (sr && since && now_ms () - since >= PREFETCH_DWELL_MS)
+    {
+      prefetch_start (g_session, sr);
+      since = 0;
     }
-  items[size] = NULL;
+}
+
+static int
+search_results_handler (int c)
+{
+  struct result_list *l = &g_browse_list;
+  struct search_result *sr = g_search_results;
+  bool is_playlists = g_status == STATUS_BROWSE_SHOW_PLAYLISTS;
+  int selected_item, n, *rows;
+  sp_track **tracks;
+  char buffer[32], prompt[64];
 
-  menu = new_menu ((ITEM **) items);
-  menu_opts_off (menu, O_SHOWDESC);
+  /* The container changed, e.g. after 'n' or 'D'.  */
+  if (l->shared && l->shared_generation != container_generation ())
+    g_search_results = sr = list_share_container (l, true);
 
-  set_menu_format (menu, g_h - 2, 0);
-  set_menu_mark (menu, " ");
-  set_menu_win (menu, list_wnd);
-  post_menu (menu);
-  wcursyncup (list_wnd);
+  c = list_filter_key (l, c);
+  list_process (l, c);
+  selected_item = list_current (l);
 
-  set_current_item (menu, items[selected_item]);
-  move (1 + selected_item, offset_x);
-  wrefresh (list_wnd);
+  hover_process (l, selected_item);
 
-  nodelay (g_mainwin, true);
+  /* Nothing happens if the results do not come from a search.  */
+  if (list_near_end (l))
+    search_more ();
 
-  for (;;)
+  if (g_status_entered && selected_item < 0)
+    msg_to_user ("No results");
+
+  /* Prompts draw over the list.  */
+  if (c == 'D' || c == 'n')
+    l->dirty = true;
+
+  /* The marked tracks are removed with a single call.  */
+  if (c == 'D' && g_browsed_playlist
+      && (n = list_marked_tracks (l, selected_item, &rows, &tracks)) > 0)
     {
-      c = getch ();
-      int next_timeout, cur_x, cur_y;
-      sp_session_process_events (g_session, &next_timeout);
-      sp_track *to_star[1];
-      char buffer[32];
-      if (c == 'D' && g_browsed_playlist
-          && read_line (buffer, sizeof (buffer), "Are you sure (type yes)?: ") == 0
+      int next_status = 0;
+
+      snprintf (prompt, sizeof prompt, "Remove %d track%s (type yes)?: ", n,
+                n > 1 ? "s" : "");
+      if (read_line (buffer, sizeof (buffer), prompt) == 0
           && strcasecmp (buffer, "yes") == 0)
         {
-          selected_item = item_index (current_item (menu));
-          if (sr[selected_item].type = TYPE_TRACK)
-            {
-              int tracks[1];
-              tracks[0] = selected_item;
-              sp_playlist_remove_tracks (g_browsed_playlist, tracks, 1);
-              g_result_to_browse.type = TYPE_PLAYLIST;
-              g_result_to_browse.playlist = g_browsed_playlist;
-              next_status = STATUS_BROWSE_RESULT;
-              goto exit_no_handler;
-
-            }
+          sp_playlist_remove_tracks (g_browsed_playlist, rows, n);
+          next_status = wait_load (load_playlist (g_browsed_playlist,
+                                                  TIMEOUT * 1000,
+                                                  playlist_loaded, NULL));
         }
+      free (rows);
+      free (tracks);
+      return next_status;
+    }
 
-      if (is_playlists)
+  if (is_playlists)
+    {
+      sp_playlistcontainer *pc;
+      switch (c)
         {
-          sp_playlistcontainer *pc;
-          char buffer[32];
-          switch (c)
+        case 'n':
+          if (! read_line (buffer, sizeof (buffer), "New playlist: "))
             {
-            case 'n':
-              if (! read_line (buffer, sizeof (buffer), "New playlist: "))
+              pc = sp_session_playlistcontainer (g_session);
+              if (pc)
                 {
-                  pc = sp_session_playlistcontainer (g_session);
-                  if (pc)
-                    {
-                      sp_playlist *pl = sp_playlistcontainer_add_new_playlist (pc, buffer);
-                      struct search_result *sr = playlists ();
-                      if (sr)
-                        {
-                          free_search_results (g_search_results);
-                          g_search_results = sr;
-                        }
-                      sp_playlist_release (pl);
-                      goto restart;
-                    }
+                  sp_playlist *pl = sp_playlistcontainer_add_new_playlist (pc, buffer);
+                  sp_playlist_release (pl);
                 }
-              break;
+            }
+          return 0;
 
-            case 'D':
-              selected_item = item_index (current_item (menu));
-              pc = sp_session_playlistcontainer (g_session);
+        case 'D':
+          pc = sp_session_playlistcontainer (g_session);
 
-              if (pc && sr[selected_item].type == TYPE_PLAYLIST)
+          if (pc && selected_item >= 0 && sr[selected_item].type == TYPE_PLAYLIST)
+            {
+              if (read_line (buffer, sizeof (buffer), "Are you sure (type yes)?: ") == 0
+                  && strcasecmp (buffer, "yes") == 0)
                 {
-                  if (read_line (buffer, sizeof (buffer), "Are you sure (type yes)?: ") == 0
-                      && strcasecmp (buffer, "yes") == 0)
-                    {
-                      struct search_result *sr = playlists ();
-                      sp_playlistcontainer_remove_playlist (pc, selected_item);
-                      sr = playlists ();
-                      if (sr)
-                        {
-                          free_search_results (g_search_results);
-                          g_search_results = sr;
-                        }
-                    }
-                  goto restart;
+                  sp_playlistcontainer_remove_playlist (pc, selected_item);
                 }
-              break;
             }
+          return 0;
         }
+    }
 
-      switch (c)
-	{
-        case '\n':
-	case KEY_RIGHT:
-          goto exit;
+  switch (c)
+    {
+    case '\n':
+    case KEY_RIGHT:
+      if (selected_item < 0)
+        break;
+      return search_result_select (&sr[selected_item]);
 
-	case ERR:
-	  if (g_force_refresh)
-	    goto exit;
+      /* Mark the track, or the tracks up to the last one marked.  */
+    case 'm':
+    case 'M':
+      if (selected_item < 0)
+        break;
+      list_mark (l, selected_item, c == 'M');
+      if (c == 'm')
+        listview_key (&l->view, KEY_DOWN);
+      break;
 
-	  usleep (100000);
-	  break;
+      /* Add to playlist.  */
+    case 'a':
+      n = list_marked_tracks (l, selected_item, &rows, &tracks);
+      if (n > 0)
+        {
+          int next_status = add_tracks_to_playlist (tracks, n);
 
-          /* Add to playlist.  */
-        case 'a':
-          selected_item = item_index (current_item (menu));
-          if (selected_item >= 0 && sr[selected_item].type == TYPE_TRACK)
-            add_track_to_playlist (sr[selected_item].track);
-
-          /* FIXME: A nicer way to redraw the menu?  */
-          unpost_menu (menu);
-          post_menu (menu);
-          break;
-
-          /* Star/Unstar.  */
-        case 'u':
-        case 's':
-          selected_item = item_index (current_item (menu));
-          if (selected_item >= 0 && sr[selected_item].type == TYPE_TRACK)
+          /* The marks are cleared once the tracks are added.  */
+          list_drop_kept_marks (l);
+          if (next_status && l->n_marked)
             {
-              to_star[0] = sr[selected_item].track;
-              sp_track_set_starred (g_session, to_star, 1, c == 's');
+              l->kept_marks = rows;
+              l->n_kept_marks = n;
             }
-          break;
-
-	case KEY_DOWN:
-	  menu_driver (menu, REQ_DOWN_ITEM);
-	  break;
-
-	case KEY_UP:
-	  menu_driver (menu, REQ_UP_ITEM);
-	  break;
-
-	case KEY_LEFT:
-	case 27:		/* ESCAPE */
-	  next_status = STATUS_HOME;
-	  goto exit_no_handler;
-	}
-
-      wrefresh (list_wnd);
-      getyx (list_wnd, cur_y, cur_x);
-
-      /* Find the first visible item.  */
-      for (i = 0; i < size; i++)
-        if (item_visible (items[i]))
-          break;
+          else
+            free (rows);
+          free (tracks);
+          return next_status;
+        }
+      break;
 
-      for (j = 0; sr[i + j].type && j < g_h - 2; j++)
+      /* Star/Unstar.  */
+    case 'u':
+    case 's':
+      n = list_marked_tracks (l, selected_item, &rows, &tracks);
+      if (n > 0)
         {
-          if (sr[i + j].type == TYPE_TRACK)
-            {
-              bool starred;
-              starred = sp_track_is_starred (g_session, sr[i + j].track);
-              print_star (j + 1, offset_x - 1, starred);
-            }
+          starred_set (tracks, n, c == 's');
+          list_clear_marks (l);
+          free (rows);
+          free (tracks);
         }
+      break;
 
-      move (cur_y + 1, cur_x + offset_x);
-    }
-
- exit:
-  selected_item = item_index (current_item (menu));
-  if (selected_item < 0)
-    selected_item = 0;
-
-  c = search_result_select (&sr[selected_item], selected);
-  if (c)
-    next_status = c;
-
- exit_no_handler:
-  nodelay (g_mainwin, false);
-
-  unpost_menu (menu);
-  free_menu (menu);
-
-  for (i = 0; i < size; ++i)
-    {
-      free_item (items[i]);
-      free (items_name[i]);
-    }
-
-  if (g_force_refresh)
-    {
-      g_force_refresh = 0;
-      goto restart;
-    }
-
-  if (g_browsed_playlist)
-    {
-      sp_playlist_release (g_browsed_playlist);
-      g_browsed_playlist = NULL;
-    }
-
-  if (next_status == STATUS_BROWSE_RESULT
-      && selected->type == TYPE_PLAYLIST)
-    next_status = STATUS_SEARCH_BROWSE_PLAYLIST;
-
-
-  return next_status;
-}
-
-static sp_playlist *
-choose_playlist ()
-{
-  int res;
-  int w = g_w < 40 ? 20 : g_w < 80 ? 40 : 60;
-  int off_x = g_w / 2 - w / 2 + 1;
-  WINDOW *wnd;
-  struct search_result selected, *sr = playlists ();
-  if (sr == NULL)
-    return NULL;
+    case KEY_LEFT:
+    case 27:		/* ESCAPE */
+      search_cancel ();
+      return STATUS_HOME;
 
-  wnd = subwin (g_mainwin, g_h - 2, w, 1, off_x);
-  res = search_results_display (sr, wnd, off_x, &selected);
-  delwin (wnd);
-  free_search_results (sr);
+    default:
+      return player_key (c);
+    }
 
-  return selected.type == TYPE_PLAYLIST ? selected.playlist : NULL;
+  return 0;
 }
 
 static void
-search_results_handler ()
+choose_playlist_close ()
 {
-  int res;
-  int w = g_w < 40 ? 20 : g_w < 80 ? 40 : 60;
-  int off_x = g_w / 2 - w / 2 + 1;
-  WINDOW *wnd = subwin (g_mainwin, g_h - 2, w, 1, off_x);
-  res = search_results_display (g_search_results, wnd, off_x, &g_result_to_browse);
-  delwin (wnd);
-
-  if (res)
-    transition_to (res);
+  if (!g_picker_list.shared)
+    list_remember (&g_picker_list);
+  list_close (&g_picker_list);
+  if (!g_picker_list.shared)
+    free_search_results (g_picker_list.results);
+  list_reset_links (&g_picker_list);
+  g_picker_list.results = NULL;
+
+  release_tracks_to_add ();
+  g_import_path[0] = '\0';
 }
 
-static void
-show_search_results ()
+static int
+choose_playlist (int c)
 {
-  time_t start = time (NULL);
-
-  if (!g_search)
-    {
-      transition_to (STATUS_HOME);
-      return;
-    }
+  struct result_list *l = &g_picker_list;
+  sp_playlist *pl;
+  int selected_item;
 
-  while (!sp_search_is_loaded (g_search))
+  if (l->results == NULL
+      || (l->shared && l->shared_generation != container_generation ()))
     {
-      int to;
-      sp_session_process_events (g_session, &to);
-      if (time (NULL) - start > TIMEOUT)
-	{
-	  transition_to (STATUS_HOME);
-	  sp_search_release (g_search);
-	  return;
-	}
-      usleep (min (to, 250) * 1000);
-    }
-
-  size_t n_el, i, j;
-  n_el = sp_search_num_tracks (g_search)
-    + sp_search_num_albums (g_search)
-    + sp_search_num_playlists (g_search) + sp_search_num_artists (g_search);
-
-  free_search_results (g_search_results);
-  g_search_results = calloc ((n_el + 1) * sizeof (struct search_result), 1);
-  i = 0;
-  for (j = 0; j < sp_search_num_tracks (g_search); j++)
-    {
-      g_search_results[i].type = TYPE_TRACK;
-      g_search_results[i].track = sp_search_track (g_search, j);
-      sp_track_add_ref (g_search_results[i++].track);
+      list_share_container (l, l->results != NULL);
+      if (l->results == NULL)
+        return g_picker_return;
     }
 
-  for (j = 0; j < sp_search_num_albums (g_search); j++)
-    {
-      g_search_results[i].type = TYPE_ALBUM;
-      g_search_results[i].album = sp_search_album (g_search, j);
-      sp_album_add_ref (g_search_results[i++].album);
-    }
+  list_process (l, c);
+  selected_item = list_current (l);
 
-  for (j = 0; j < sp_search_num_playlists (g_search); j++)
+  switch (c)
     {
-      g_search_results[i].type = TYPE_PLAYLIST;
-      g_search_results[i].playlist = sp_search_playlist (g_search, j);
-      sp_playlist_add_ref (g_search_results[i++].playlist);
-    }
+    case '\n':
+    case KEY_RIGHT:
+      if (selected_item >= 0 && l->results[selected_item].type == TYPE_PLAYLIST)
+        {
+          pl = l->results[selected_item].playlist;
+          if (g_import_path[0])
+            {
+              if (import_start (g_session, g_import_path, pl, NULL) < 0)
+                msg_to_user ("Cannot read the file");
+            }
+          else
+            {
+              sp_playlist_add_tracks (pl, g_tracks_to_add,
+                                      g_n_tracks_to_add,
+                                      sp_playlist_num_tracks (pl), g_session);
+              list_drop_kept_marks (&g_browse_list);
+            }
+        }
+      return g_picker_return;
 
-  for (j = 0; j < sp_search_num_artists (g_search); j++)
-    {
-      g_search_results[i].type = TYPE_ARTIST;
-      g_search_results[i].artist = sp_search_artist (g_search, j);
-      sp_artist_add_ref (g_search_results[i++].artist);
+    case KEY_LEFT:
+    case 27:
+      return g_picker_return;
     }
 
-  sp_search_release (g_search);
-
-  g_search = NULL;
-
-  transition_to (STATUS_BROWSE_SHOW);
+  return 0;
 }
 
-void
-artistbrowse_complete (sp_artistbrowse * result, void *userdata)
+/* Wait for the first category to arrive, the others are appended to
+   the list while it is shown.  */
+static int
+show_search_results (int c)
 {
+  if (g_search_results && g_search_results[0].type)
+    return STATUS_BROWSE_SHOW;
 
-}
+  if (c == 27)
+    {
+      search_cancel ();
+      return STATUS_HOME;
+    }
 
-void
-albumbrowse_complete (sp_albumbrowse * result, void *userdata)
-{
+  if (!search_pending ())
+    {
+      msg_to_user ("No results");
+      return STATUS_HOME;
+    }
 
+  if (g_status_entered)
+    msg_to_user ("searching..");
+  return 0;
 }
 
 static void
-show_browse_result ()
+screen_leave (int status)
 {
-  sp_artistbrowse *arb;
-  sp_albumbrowse *alb;
-  size_t ret, i, j;
-  time_t start = time (NULL);
+  switch (status)
+    {
+    case STATUS_LOGIN:
+      login_close ();
+      break;
 
-  free_search_results (g_search_results);
-  g_search_results = NULL;
+    case STATUS_HOME:
+      home_menu_close ();
+      break;
 
-  switch (g_result_to_browse.type)
-    {
-    case TYPE_ARTIST:
-      if (!sp_artist_is_loaded (g_result_to_browse.artist))
-	return;
+    case STATUS_BROWSE_SHOW:
+    case STATUS_BROWSE_SHOW_PLAYLISTS:
+      list_close (&g_browse_list);
+      prefetch_cancel ();
+      break;
 
-      arb = sp_artistbrowse_create (g_session, g_result_to_browse.artist,
-				    SP_ARTISTBROWSE_FULL,
-				    artistbrowse_complete, g_search_results);
-      while (!sp_artistbrowse_is_loaded (arb))
-	{
-	  int to;
-	  sp_session_process_events (g_session, &to);
-	  if (time (NULL) - start > TIMEOUT)
-	    return;
-	  usleep (min (to, 250) * 1000);
-	}
-      ret = sp_artistbrowse_num_tracks (arb)
-	+ sp_artistbrowse_num_albums (arb);
+    case STATUS_CHOOSE_PLAYLIST:
+      choose_playlist_close ();
+      break;
 
-      g_search_results =
-	calloc ((ret + 1) * sizeof (struct search_result), 1);
-      i = 0;
-      for (j = 0; j < sp_artistbrowse_num_albums (arb); j++)
-	{
-	  g_search_results[i].type = TYPE_ALBUM;
-	  g_search_results[i].album = sp_artistbrowse_album (arb, j);
-	  sp_album_add_ref (g_search_results[i].album);
-	}
+    case STATUS_SEARCH_INPUT:
+      list_close (&g_browse_list);
+      g_browse_list.top = 1;
+      curs_set (0);
+      break;
 
-      for (j = 0; j < sp_artistbrowse_num_tracks (arb); j++)
-	{
-	  g_search_results[i].type = TYPE_TRACK;
-	  g_search_results[i].track = sp_artistbrowse_track (arb, j);
-	  sp_track_add_ref (g_search_results[i++].track);
-	}
-      sp_artistbrowse_release (arb);
-      sp_artist_release (g_result_to_browse.artist);
+    case STATUS_PLAYING:
+      g_shown_track = NULL;
       break;
+    }
+}
 
-    case TYPE_ALBUM:
-      if (!sp_album_is_loaded (g_result_to_browse.album))
-	return;
+static void
+process_events (int *next_timeout)
+{
+  long long start = metrics_start (), span = trace_begin ();
 
-      alb = sp_albumbrowse_create (g_session, g_result_to_browse.album,
-				   albumbrowse_complete, g_search_results);
-      while (!sp_albumbrowse_is_loaded (alb))
-	{
-	  int to;
-	  sp_session_process_events (g_session, &to);
-	  if (time (NULL) - start > TIMEOUT)
-	    return;
-	  usleep (min (to, 250) * 1000);
-	}
+  sp_session_process_events (g_session, next_timeout);
+  metrics_stop (METRIC_PROCESS_EVENTS, start);
+  trace_end ("process events", span);
+}
 
-      ret = sp_albumbrowse_num_tracks (alb);
+/* The metrics, over the top right corner of every screen.  They are
+   collected only while they are shown or written to METRICS_FILE.  */
+#define METRICS_OVERLAY_W 56
 
-      g_search_results =
-	calloc ((ret + 1) * sizeof (struct search_result), 1);
-      i = 0;
-      for (j = 0; i < ret; j++)
-	{
-	  g_search_results[i].type = TYPE_TRACK;
-	  g_search_results[i].track = sp_albumbrowse_track (alb, j);
-	  sp_track_add_ref (g_search_results[i++].track);
-	}
+static bool g_metrics_overlay;
 
-      sp_albumbrowse_release (alb);
-      sp_album_release (g_result_to_browse.album);
-      break;
+static void
+toggle_metrics_overlay ()
+{
+  int i, w = min (METRICS_OVERLAY_W, g_w - 2);
 
-    case TYPE_PLAYLIST:
-      while (!sp_playlist_is_loaded (g_result_to_browse.playlist))
-	{
-	  int to;
-	  sp_session_process_events (g_session, &to);
-	  if (time (NULL) - start > TIMEOUT)
-	    return;
-	  usleep (min (to, 250) * 1000);
-	}
+  g_metrics_overlay = !g_metrics_overlay;
+  metrics_enable (g_metrics_overlay || g_metrics_file);
+  if (g_metrics_overlay || g_h < METRIC_COUNT + 2 || w < 20)
+    return;
 
-      ret = sp_playlist_num_tracks (g_result_to_browse.playlist);
+  /* Blank what the overlay covered, and have the screen below draw it
+     again.  */
+  attrset (COLOR_PAIR (COLOR_DEFAULT));
+  for (i = 0; i < METRIC_COUNT; i++)
+    mvhline (1 + i, g_w - 1 - w, ' ', w);
 
-      g_search_results =
-	calloc ((ret + 1) * sizeof (struct search_result), 1);
-      i = 0;
-      for (j = 0; i < ret; j++)
-	{
-	  g_search_results[i].type = TYPE_TRACK;
-	  g_search_results[i].track =
-	    sp_playlist_track (g_result_to_browse.playlist, j);
-	  sp_track_add_ref (g_search_results[i++].track);
-	}
+  g_browse_list.dirty = true;
+  g_picker_list.dirty = true;
+  if (g_home_menu)
+    {
+      unpost_menu (g_home_menu);
+      post_menu (g_home_menu);
+      wnoutrefresh (g_home_wnd);
+    }
+  g_screen_generation++;
+  force_redraw = true;
+  g_force_refresh = 1;
+  frame_damage ();
+}
 
-      /*FIXME: keep the whole sr, not just playlist.  */
-      g_browsed_playlist = g_result_to_browse.playlist;
-      sp_playlist_add_ref (g_browsed_playlist);
+static void
+draw_metrics_overlay ()
+{
+  static long long drawn;
+  static unsigned long drawn_screen;
+  long long now = now_ms ();
+  int i, w = min (METRICS_OVERLAY_W, g_w - 2);
+  char line[128];
+
+  if (!g_metrics_overlay || g_h < METRIC_COUNT + 2 || w < 20
+      || (now - drawn < 1000 && drawn_screen == g_screen_generation))
+    return;
+  drawn = now;
+  drawn_screen = g_screen_generation;
 
-      sp_playlist_release (g_result_to_browse.playlist);
-      break;
+  attrset (COLOR_PAIR (COLOR_MESSAGE));
+  for (i = 0; i < METRIC_COUNT; i++)
+    {
+      metrics_format (i, line, sizeof line);
+      mvprintw (1 + i, g_w - 1 - w, "%-*.*s", w, w, line);
     }
+  attrset (COLOR_PAIR (COLOR_DEFAULT));
+  frame_damage ();
+}
+
+/* Work that must go on whatever the screen is doing.  */
+static void
+idle_tick ()
+{
+  int next_timeout;
 
-  transition_to (g_search_results ? STATUS_BROWSE_SHOW : STATUS_HOME);
-  g_result_to_browse.type = TYPE_LAST;
+  process_events (&next_timeout);
+  player_process ();
+  draw_status_line ();
 }
 
 static int
 main_loop ()
 {
-  int next_timeout;
+  int next_timeout = 0;
   for (;;)
     {
+      int c, next_status = 0;
+
       if (g_status != STATUS_NOT_LOGGED)
-	sp_session_process_events (g_session, &next_timeout);
+	process_events (&next_timeout);
+
+      player_process ();
+      search_process ();
+      load_process ();
+      starred_process ();
+      fill_process ();
+      library_process ();
+      import_process ();
+      import_report ();
+
+      /* Wait for a key, but never longer than libspotify wants us to.  */
+      c = frame_getch (min (max (next_timeout, 10), 100));
+      if (c == KEY_F (12))
+        {
+          toggle_metrics_overlay ();
+          c = ERR;
+        }
+      if (c == ERR)
+        meta_process ();
 
       switch (g_status)
 	{
 	case STATUS_NOT_LOGGED:
-	  transition_to (STATUS_AUTOMATIC_LOGIN);
+	  next_status = STATUS_AUTOMATIC_LOGIN;
 	  break;
 
 	case STATUS_AUTOMATIC_LOGIN:
-	  automatic_login ();
+	  next_status = automatic_login ();
 	  break;
 
 	case STATUS_LOGIN:
-	  login ();
+	  next_status = login (c);
 	  break;
 
 	case STATUS_LOGGING_IN:
-	  logging_in ();
+	  next_status = logging_in ();
 	  break;
 
 	case STATUS_HOME:
-	  show_menu ();
+	  next_status = show_menu (c);
 	  break;
 
 	case STATUS_SEARCH_BROWSE:
-	  show_search_results ();
+	  next_status = show_search_results (c);
+	  break;
+
+	case STATUS_SEARCH_INPUT:
+	  next_status = search_input (c);
 	  break;
 
 	case STATUS_BROWSE_SHOW:
 	case STATUS_BROWSE_SHOW_PLAYLISTS:
-	  search_results_handler ();
+	  next_status = search_results_handler (c);
 	  break;
 
-	case STATUS_BROWSE_RESULT:
-	case STATUS_SEARCH_BROWSE_PLAYLIST:
-	  show_browse_result ();
+	case STATUS_LOADING:
+	  next_status = show_loading (c);
+	  break;
+
+	case STATUS_CHOOSE_PLAYLIST:
+	  next_status = choose_playlist (c);
 	  break;
 
 	case STATUS_PLAYING:
-	  show_playing ();
+	  next_status = show_playing (c);
 	  break;
 
 	default:
-	  exit (EXIT_FAILURE);
+	  quit (EXIT_FAILURE);
 	}
+
+      g_status_entered = false;
+      if (next_status)
+        transition_to (next_status);
+
+      draw_status_line ();
+      draw_metrics_overlay ();
+      metrics_dump (METRICS_FILE);
+    }
+}
+
+/* Daemon mode: the session is driven by the commands of the control
+   socket instead of the keyboard.  */
+#define CONTROL_MAX_ARGS 256
+
+/* The queue was replaced, start it once its first track is loaded.  */
+static bool g_daemon_start;
+static bool g_daemon_shutdown;
+
+/* Add to the queue the tracks of the N LINKS, return how many were
+   added.  With REPLACE the queue is emptied first, only if one of the
+   links is a track.  */
+static int
+enqueue_links (char **links, int n, bool replace)
+{
+  struct search_result *tracks = malloc (n * sizeof *tracks);
+  int i, n_tracks = 0, added = 0;
+
+  if (tracks == NULL)
+    return 0;
+
+  for (i = 0; i < n; i++)
+    {
+      struct search_result sr;
+
+      if (search_result_from_link (g_session, links[i], &sr) < 0)
+        continue;
+      if (sr.type == TYPE_TRACK)
+        tracks[n_tracks++] = sr;
+      else
+        search_result_release (&sr);
+    }
+
+  if (n_tracks && replace)
+    queue_clear (g_play_queue);
+  for (i = 0; i < n_tracks; i++)
+    {
+      if (queue_add (g_play_queue, tracks[i].track))
+        added++;
+      search_result_release (&tracks[i]);
+    }
+
+  free (tracks);
+  return added;
+}
+
+static void
+control_command (char *line, char *reply, size_t len)
+{
+  char *argv[CONTROL_MAX_ARGS], *save, *cmd, buffer[256];
+  int argc = 0, n;
+
+  for (cmd = strtok_r (line, " \t", &save); cmd && argc < CONTROL_MAX_ARGS;
+       cmd = strtok_r (NULL, " \t", &save))
+    argv[argc++] = cmd;
+  if (argc == 0)
+    {
+      snprintf (reply, len, "error empty command");
+      return;
+    }
+  cmd = argv[0];
+
+  if (strcmp (cmd, "play") == 0 || strcmp (cmd, "enqueue") == 0)
+    {
+      bool play = cmd[0] == 'p';
+
+      n = enqueue_links (argv + 1, argc - 1, play);
+      if (n == 0)
+        {
+          snprintf (reply, len, "error no track to %s", cmd);
+          return;
+        }
+      if (play)
+        {
+          player_stop ();
+          g_daemon_start = true;
+        }
+      snprintf (reply, len, "ok %d", n);
+    }
+  else if (strcmp (cmd, "next") == 0)
+    {
+      player_stop ();
+      g_daemon_start = true;
+      snprintf (reply, len, "ok");
+    }
+  else if (strcmp (cmd, "pause") == 0 || strcmp (cmd, "resume") == 0)
+    {
+      if (g_current_track == NULL)
+        {
+          snprintf (reply, len, "error nothing is playing");
+          return;
+        }
+      player_pause (cmd[0] == 'p');
+      snprintf (reply, len, "ok");
+    }
+  else if (strcmp (cmd, "seek") == 0 && argc == 2)
+    {
+      if (g_current_track == NULL)
+        {
+          snprintf (reply, len, "error nothing is playing");
+          return;
+        }
+      player_seek (atoi (argv[1]));
+      snprintf (reply, len, "ok");
+    }
+  else if (strcmp (cmd, "status") == 0)
+    {
+      if (g_current_track == NULL
+          || track_link (g_current_track, buffer, sizeof buffer) < 0)
+        snprintf (reply, len, "ok stopped");
+      else
+        snprintf (reply, len, "ok %s %s %d %d",
+                  g_paused ? "paused" : "playing", buffer,
+                  g_sample_rate ? g_elapsed_frames / g_sample_rate : 0,
+                  sp_track_duration (g_current_track) / 1000);
+    }
+  else if (strcmp (cmd, "import") == 0 && (argc == 2 || argc == 3))
+    {
+      struct search_result sr;
+      sp_playlist *pl = NULL;
+
+      if (argc == 3)
+        {
+          if (search_result_from_link (g_session, argv[2], &sr) < 0)
+            sr.type = TYPE_LAST;
+          if (sr.type != TYPE_PLAYLIST)
+            {
+              if (sr.type != TYPE_LAST)
+                search_result_release (&sr);
+              snprintf (reply, len, "error not a playlist link");
+              return;
+            }
+          pl = sr.playlist;
+        }
+
+      import_full_path (argv[1], buffer, sizeof buffer);
+      if (import_start (g_session, buffer, pl, g_play_queue) < 0)
+        snprintf (reply, len, "error cannot import %s", buffer);
+      else
+        snprintf (reply, len, "ok");
+      if (pl)
+        sp_playlist_release (pl);
+    }
+  else if (strcmp (cmd, "shutdown") == 0)
+    {
+      g_daemon_shutdown = true;
+      snprintf (reply, len, "ok");
+    }
+  else
+    snprintf (reply, len, "error unknown command %s", cmd);
+}
+
+static void
+daemon_start_playback ()
+{
+  sp_track *next;
+
+  if (!g_daemon_start)
+    return;
+
+  /* A track is loaded by the player only once its metadata is.  */
+  next = queue_peek_next (g_play_queue, 0);
+  if (next && !sp_track_is_loaded (next))
+    return;
+
+  g_daemon_start = false;
+  if (!player_next ())
+    control_event ("end");
+}
+
+static void
+daemon_loop ()
+{
+  int next_timeout = 0;
+
+  for (;;)
+    {
+      process_events (&next_timeout);
+      if (g_status == STATUS_LOGIN)
+        {
+          fprintf (stderr, "Login failed.\n");
+          quit (EXIT_FAILURE);
+        }
+
+      player_process ();
+      load_process ();
+      starred_process ();
+      library_process ();
+      import_process ();
+      import_report ();
+      daemon_start_playback ();
+      metrics_dump (METRICS_FILE);
+
+      /* The replies are written before the daemon exits.  */
+      control_poll (min (max (next_timeout, 10), 100));
+      if (g_daemon_shutdown)
+        quit (EXIT_SUCCESS);
+    }
+}
+
+static void
+export_loop ()
+{
+  int next_timeout = 0;
+  bool started = false;
+
+  for (;;)
+    {
+      process_events (&next_timeout);
+      if (g_status == STATUS_LOGIN)
+        {
+          fprintf (stderr, "Login failed.\n");
+          quit (EXIT_FAILURE);
+        }
+
+      if (!started && g_status == STATUS_HOME)
+        {
+          export_start (g_session, stdout, g_export);
+          started = true;
+        }
+
+      load_process ();
+      starred_process ();
+      if (export_process ())
+        quit (fflush (stdout) == 0 && !ferror (stdout)
+              ? EXIT_SUCCESS : EXIT_FAILURE);
+
+      usleep (min (max (next_timeout, 10), 100) * 1000);
     }
 }
 
 static void
 logged_in (sp_session *session, sp_error error)
 {
+  trace_async_end ("login", session);
+  if (g_status != STATUS_LOGGING_IN)
+    return;
+
   if (error == SP_ERROR_OK)
-    transition_to (STATUS_HOME);
+    {
+      startup_mark ("logged in");
+      starred_start (session);
+      container_start (session);
+      /* The export loads the same playlists, don't compete with it.  */
+      if (g_export < 0)
+        library_start (session);
+      transition_to (STATUS_HOME);
+    }
   else
     transition_to (STATUS_LOGIN);
 }
@@ -1477,6 +3241,9 @@ static int
 music_delivery (sp_session *session, const sp_audioformat * format,
                 const void *frames, int num_frames)
 {
+  long long start, span;
+  int written;
+
   if (num_frames == 0)
     {
       if (g_seek_off >= 0)
@@ -1486,9 +3253,15 @@ music_delivery (sp_session *session, const sp_audioformat * format,
       return 0;
     }
 
+  span = trace_begin ();
+  start = metrics_start ();
   g_elapsed_frames += num_frames;
   g_sample_rate = format->sample_rate;
-  return sound_write (frames, num_frames);
+  written = sound_write (frames, num_frames);
+  metrics_count (METRIC_AUDIO_FRAMES, max (written, 0));
+  metrics_stop (METRIC_MUSIC_DELIVERY, start);
+  trace_end ("music delivery", span);
+  return written;
 }
 
 static void
@@ -1577,9 +3350,7 @@ init_session ()
   config.user_agent = "libspotify";
   config.callbacks = &callbacks;
 
-  g_search = NULL;
   g_search_results = NULL;
-  g_result_to_browse.type = TYPE_LAST;
   sp_session_create (&config, &g_session);
   g_play_queue = queue_make (g_session, 128);
 }
@@ -1619,8 +3390,10 @@ reset_graphics (bool resize)
   color_set (1, NULL);
 
   content_wnd = subwin (g_mainwin, g_w - 2, g_h - 2, 1, 1);
+  frame_init ();
 
   curs_set (0);
+  g_screen_generation++;
 
   force_redraw = true;
 }
@@ -1634,38 +3407,130 @@ on_sigwinch ()
 int
 main (int argc, char *const *argv)
 {
-  int opt;
-  setlocale (LC_ALL, "");
-  if ((g_mainwin = initscr ()) == NULL)
+  static const struct option options[] =
     {
-      fprintf (stderr, "Error loading ncurses.\n");
-      exit (EXIT_FAILURE);
-    }
+      {"daemon", no_argument, NULL, 'D'},
+      {"export", optional_argument, NULL, 'E'},
+      {NULL, 0, NULL, 0}
+    };
+  int opt;
+  FILE *tty;
 
-  if (sound_init () < 0)
-    {
-      fprintf (stderr, "Error loading the sound driver.\n");
-      exit (EXIT_FAILURE);
-    }
+  g_startup_start = now_ms ();
+  setlocale (LC_ALL, "");
+  g_start_dir = getcwd (NULL, 0);
 
-  while ((opt = getopt (argc, argv, "d")) >= 0)
+  frame_set_low_bandwidth (getenv ("SSH_CONNECTION") != NULL);
+  while ((opt = getopt_long (argc, argv, "dClLmT:", options, NULL)) >= 0)
     {
       switch (opt)
 	{
 	case 'd':
 	  g_debug = 1;
 	  break;
+
+	case 'D':
+	  g_daemon = true;
+	  break;
+
+	case 'E':
+	  if (optarg == NULL || strcmp (optarg, "jsonl") == 0)
+	    g_export = EXPORT_JSONL;
+	  else if (strcmp (optarg, "csv") == 0)
+	    g_export = EXPORT_CSV;
+	  else
+	    {
+	      fprintf (stderr, "Unknown export format %s, use jsonl or csv.\n",
+	               optarg);
+	      exit (EXIT_FAILURE);
+	    }
+	  break;
+
+	case 'C':
+	  g_persist_cache = false;
+	  break;
+
+	case 'm':
+	  g_metrics_file = true;
+	  metrics_enable (true);
+	  break;
+
+	case 'T':
+	  /* Opened before moving to ~/.shpotify, relative paths are
+	     from the current directory.  */
+	  if (trace_start (optarg) < 0)
+	    {
+	      fprintf (stderr, "Cannot write the trace to %s: %s\n", optarg,
+	               strerror (errno));
+	      exit (EXIT_FAILURE);
+	    }
+	  break;
+
+	case 'l':
+	case 'L':
+	  frame_set_low_bandwidth (opt == 'l');
+	  break;
 	}
     }
 
   init_wd ();
-  atexit (atexit_cleanup);
-  g_status = STATUS_NOT_LOGGED;
+  cache_init (g_persist_cache ? "search-cache" : NULL, SEARCH_CACHE_ENTRIES,
+              SEARCH_CACHE_TTL);
+  meta_init (g_persist_cache ? "metadata" : NULL);
+  startup_mark ("caches");
+
+  /* The login goes on while the terminal is set up.  */
+  init_session ();
+  startup_mark ("session");
+  g_status = automatic_login ();
+  startup_mark ("login sent");
+
+  if (g_export >= 0)
+    {
+      if (g_status != STATUS_LOGGING_IN)
+        {
+          fprintf (stderr, "No saved credentials, log in once without "
+                   "--export.\n");
+          exit (EXIT_FAILURE);
+        }
+
+      atexit (atexit_cleanup);
+      export_loop ();
+    }
+
+  if (g_daemon)
+    {
+      if (g_status != STATUS_LOGGING_IN)
+        {
+          fprintf (stderr, "No saved credentials, log in once without "
+                   "--daemon.\n");
+          exit (EXIT_FAILURE);
+        }
+
+      if (control_start (CONTROL_SOCKET, control_command) < 0)
+        {
+          fprintf (stderr, "Cannot listen on ~/.shpotify/%s: %s\n",
+                   CONTROL_SOCKET, strerror (errno));
+          exit (EXIT_FAILURE);
+        }
+
+      atexit (atexit_cleanup);
+      daemon_loop ();
+    }
 
+  if ((tty = frame_tty ()) == NULL || newterm (NULL, tty, stdin) == NULL
+      || (g_mainwin = stdscr) == NULL)
+    {
+      fprintf (stderr, "Error loading ncurses.\n");
+      exit (EXIT_FAILURE);
+    }
+
+  atexit (atexit_cleanup);
   reset_graphics (false);
   signal(SIGWINCH, on_sigwinch);
-
-  init_session ();
+  g_status_since = time (NULL);
+  g_status_entered = true;
+  startup_mark ("terminal");
 
   main_loop ();
 
@@ -0,0 +1,479 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shpotify.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Names seen in a previous run, shown until libspotify loads the
+   metadata.  The cache is a hash table keyed on the link, in a file
+   mapped in memory:
+
+     struct meta_header
+     struct meta_slot slots[n_slots]
+     char pool[]    "<name>\0<artist>\0<album>\0" per entry
+
+   The names seen in this run are kept in memory and written with the
+   mapped ones by meta_save, the most recent first, as long as they fit
+   in META_MAX_ENTRIES and META_MAX_POOL.  */
+
+#define META_MAGIC "shpmeta\0"
+#define META_VERSION 1
+
+struct meta_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t n_slots;
+  uint32_t n_entries;
+  uint32_t pool_size;
+};
+
+struct meta_slot
+{
+  /* 0 for an empty slot.  */
+  uint64_t hash;
+  uint32_t text;
+  uint32_t duration;
+};
+
+/* A table in memory, the texts of its slots are offsets in POOL.  */
+struct meta_table
+{
+  struct meta_slot *slots;
+  uint32_t n_slots, n_entries;
+  char *pool;
+  size_t pool_size, pool_allocated;
+};
+
+static char *g_path;
+static void *g_map;
+static size_t g_map_size;
+static const struct meta_header *g_header;
+static const struct meta_slot *g_slots;
+static const char *g_pool;
+
+static struct meta_table g_pending;
+
+static uint64_t
+hash_link (const char *link)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  while (*link)
+    h = (h ^ (unsigned char) *link++) * 0x100000001b3ULL;
+
+  return h ? h : 1;
+}
+
+static const struct meta_slot *
+slot_find (const struct meta_slot *slots, uint32_t n_slots, uint64_t h)
+{
+  uint32_t i;
+
+  if (n_slots == 0)
+    return NULL;
+
+  for (i = h & (n_slots - 1); slots[i].hash; i = (i + 1) & (n_slots - 1))
+    if (slots[i].hash == h)
+      return &slots[i];
+
+  return NULL;
+}
+
+static struct meta_slot *
+slot_insert (struct meta_table *t, uint64_t h)
+{
+  uint32_t i;
+
+  for (i = h & (t->n_slots - 1); t->slots[i].hash && t->slots[i].hash != h;
+       i = (i + 1) & (t->n_slots - 1))
+    ;
+  if (t->slots[i].hash == 0)
+    t->n_entries++;
+  t->slots[i].hash = h;
+  return &t->slots[i];
+}
+
+static size_t
+text_size (const char *text)
+{
+  const char *p = text;
+  int i;
+
+  for (i = 0; i < 3; i++)
+    p += strlen (p) + 1;
+  return p - text;
+}
+
+/* Add H to T with TEXT, T must have room for it.  */
+static int
+table_add (struct meta_table *t, uint64_t h, const char *text,
+           uint32_t duration)
+{
+  size_t size = text_size (text);
+  struct meta_slot *slot;
+
+  if (t->pool_size + size > t->pool_allocated)
+    {
+      size_t n = max (t->pool_allocated * 2, t->pool_size + size + 4096);
+      char *pool = realloc (t->pool, n);
+      if (pool == NULL)
+        return -1;
+      t->pool = pool;
+      t->pool_allocated = n;
+    }
+
+  memcpy (t->pool + t->pool_size, text, size);
+  slot = slot_insert (t, h);
+  slot->text = t->pool_size;
+  slot->duration = duration;
+  t->pool_size += size;
+  return 0;
+}
+
+/* Make room in T for one more entry, doubling its slots when it is
+   half full.  */
+static int
+table_reserve (struct meta_table *t)
+{
+  struct meta_slot *old = t->slots;
+  uint32_t i, n_old = t->n_slots;
+
+  if (old && (t->n_entries + 1) * 2 <= n_old)
+    return 0;
+
+  t->n_slots = old ? n_old * 2 : 64;
+  t->slots = calloc (t->n_slots, sizeof *t->slots);
+  if (t->slots == NULL)
+    {
+      t->slots = old;
+      t->n_slots = n_old;
+      return -1;
+    }
+
+  t->n_entries = 0;
+  for (i = 0; i < n_old; i++)
+    if (old[i].hash)
+      *slot_insert (t, old[i].hash) = old[i];
+  free (old);
+  return 0;
+}
+
+static int
+table_init (struct meta_table *t, uint32_t max_entries)
+{
+  memset (t, 0, sizeof *t);
+  for (t->n_slots = 64; t->n_slots < max_entries * 2; t->n_slots *= 2)
+    ;
+  t->slots = calloc (t->n_slots, sizeof *t->slots);
+  return t->slots ? 0 : -1;
+}
+
+static void
+table_free (struct meta_table *t)
+{
+  free (t->slots);
+  free (t->pool);
+  memset (t, 0, sizeof *t);
+}
+
+static void
+unmap ()
+{
+  if (g_map)
+    munmap (g_map, g_map_size);
+  g_map = NULL;
+  g_header = NULL;
+  g_slots = NULL;
+}
+
+static void
+map ()
+{
+  const struct meta_header *h;
+  struct stat st;
+  int fd = open (g_path, O_RDONLY);
+
+  if (fd < 0)
+    return;
+
+  if (fstat (fd, &st) < 0 || (size_t) st.st_size < sizeof *h)
+    {
+      close (fd);
+      return;
+    }
+
+  g_map_size = st.st_size;
+  g_map = mmap (NULL, g_map_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (g_map == MAP_FAILED)
+    {
+      g_map = NULL;
+      return;
+    }
+
+  /* A cache written by another version is ignored, and replaced by the
+     next meta_save.  */
+  h = g_map;
+  if (memcmp (h->magic, META_MAGIC, sizeof h->magic)
+      || h->version != META_VERSION
+      || (h->n_slots & (h->n_slots - 1)) != 0
+      || sizeof *h + (size_t) h->n_slots * sizeof *g_slots + h->pool_size
+         != g_map_size)
+    {
+      unmap ();
+      return;
+    }
+
+  g_header = h;
+  g_slots = (const struct meta_slot *) (h + 1);
+  g_pool = (const char *) (g_slots + h->n_slots);
+}
+
+/* The link of SR, or NULL.  */
+static const char *
+link_of (struct search_result *sr, char *buffer, int len)
+{
+  if (sr->type == TYPE_LINK)
+    return sr->link[0] ? sr->link : NULL;
+
+  if (search_result_link (sr, buffer, len) < 0)
+    return NULL;
+  return buffer;
+}
+
+const char *
+meta_name (struct search_result *sr)
+{
+  const struct meta_slot *slot;
+  char buffer[256];
+  const char *link = link_of (sr, buffer, sizeof buffer);
+  uint64_t h;
+
+  if (link == NULL)
+    return NULL;
+
+  h = hash_link (link);
+  slot = slot_find (g_pending.slots, g_pending.n_slots, h);
+  if (slot)
+    return g_pending.pool + slot->text;
+
+  slot = g_header ? slot_find (g_slots, g_header->n_slots, h) : NULL;
+  return slot ? g_pool + slot->text : NULL;
+}
+
+/* The name, artist and album of SR, if its metadata is loaded.  */
+static int
+meta_text (struct search_result *sr, char *text, size_t len,
+           uint32_t *duration)
+{
+  const char *name = NULL, *artist = "", *album = "";
+  sp_album *a;
+  sp_artist *ar;
+  int n;
+
+  *duration = 0;
+  switch (sr->type)
+    {
+    case TYPE_TRACK:
+      if (!sp_track_is_loaded (sr->track))
+        return -1;
+      name = sp_track_name (sr->track);
+      *duration = sp_track_duration (sr->track);
+      ar = sp_track_num_artists (sr->track) ? sp_track_artist (sr->track, 0)
+        : NULL;
+      if (ar && sp_artist_is_loaded (ar))
+        artist = sp_artist_name (ar);
+      a = sp_track_album (sr->track);
+      if (a && sp_album_is_loaded (a))
+        album = sp_album_name (a);
+      break;
+
+    case TYPE_ALBUM:
+      if (sp_album_is_loaded (sr->album))
+        name = sp_album_name (sr->album);
+      break;
+
+    case TYPE_ARTIST:
+      if (sp_artist_is_loaded (sr->artist))
+        name = sp_artist_name (sr->artist);
+      break;
+
+    case TYPE_PLAYLIST:
+      if (sp_playlist_is_loaded (sr->playlist))
+        name = sp_playlist_name (sr->playlist);
+      break;
+    }
+
+  if (name == NULL)
+    return -1;
+
+  n = snprintf (text, len, "%s%c%s%c%s", name, 0, artist, 0, album);
+  if (n < 0 || (size_t) n >= len)
+    return -1;
+  text[n] = '\0';
+  return 0;
+}
+
+void
+meta_remember (struct search_result *sr)
+{
+  const struct meta_slot *slot;
+  char buffer[256], text[768];
+  const char *link, *cached;
+  uint32_t duration;
+  uint64_t h;
+
+  /* Without a file, the names are still kept for this run.  */
+  if (meta_text (sr, text, sizeof text, &duration) < 0)
+    return;
+
+  link = link_of (sr, buffer, sizeof buffer);
+  if (link == NULL)
+    return;
+
+  h = hash_link (link);
+  slot = slot_find (g_pending.slots, g_pending.n_slots, h);
+  cached = slot ? g_pending.pool + slot->text : NULL;
+  if (slot == NULL && g_header)
+    {
+      slot = slot_find (g_slots, g_header->n_slots, h);
+      cached = slot ? g_pool + slot->text : NULL;
+    }
+
+  if (cached && text_size (cached) == text_size (text)
+      && memcmp (cached, text, text_size (text)) == 0
+      && slot->duration == duration)
+    return;
+
+  /* Only the names that fit in the file are kept, it is written out
+     by meta_process.  */
+  if (g_pending.n_entries >= META_MAX_ENTRIES
+      || table_reserve (&g_pending) < 0)
+    return;
+
+  table_add (&g_pending, h, text, duration);
+}
+
+void
+meta_save ()
+{
+  struct meta_table t;
+  struct meta_header h;
+  char *tmp;
+  uint32_t i;
+  FILE *out;
+
+  if (g_path == NULL || g_pending.n_entries == 0)
+    return;
+
+  if (table_init (&t, META_MAX_ENTRIES) < 0)
+    return;
+
+  /* The names seen in this run first, then the older ones while they
+     fit.  */
+  for (i = 0; i < g_pending.n_slots; i++)
+    if (g_pending.slots[i].hash)
+      table_add (&t, g_pending.slots[i].hash,
+                 g_pending.pool + g_pending.slots[i].text,
+                 g_pending.slots[i].duration);
+
+  for (i = 0; g_header && i < g_header->n_slots; i++)
+    {
+      const struct meta_slot *s = &g_slots[i];
+
+      if (t.n_entries >= META_MAX_ENTRIES)
+        break;
+      if (s->hash == 0 || slot_find (t.slots, t.n_slots, s->hash)
+          || t.pool_size + text_size (g_pool + s->text) > META_MAX_POOL)
+        continue;
+      table_add (&t, s->hash, g_pool + s->text, s->duration);
+    }
+
+  memset (&h, 0, sizeof h);
+  memcpy (h.magic, META_MAGIC, sizeof h.magic);
+  h.version = META_VERSION;
+  h.n_slots = t.n_slots;
+  h.n_entries = t.n_entries;
+  h.pool_size = t.pool_size;
+
+  tmp = malloc (strlen (g_path) + 5);
+  if (tmp == NULL)
+    {
+      table_free (&t);
+      return;
+    }
+  sprintf (tmp, "%s.new", g_path);
+
+  out = fopen (tmp, "w");
+  if (out)
+    {
+      fwrite (&h, sizeof h, 1, out);
+      fwrite (t.slots, sizeof *t.slots, t.n_slots, out);
+      fwrite (t.pool, 1, t.pool_size, out);
+      if (fclose (out) == 0 && rename (tmp, g_path) == 0)
+        {
+          unmap ();
+          map ();
+          table_free (&g_pending);
+        }
+      else
+        unlink (tmp);
+    }
+
+  free (tmp);
+  table_free (&t);
+}
+
+void
+meta_process ()
+{
+  static long long last;
+
+  if (g_path == NULL || g_pending.n_entries < META_SAVE_PENDING
+      || now_ms () - last < META_SAVE_INTERVAL_MS)
+    return;
+
+  last = now_ms ();
+  meta_save ();
+}
+
+void
+meta_init (const char *path)
+{
+  g_path = path ? strdup (path) : NULL;
+  if (g_path)
+    map ();
+}
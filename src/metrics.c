@@ -0,0 +1,242 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shpotify.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Counters and latency histograms, updated from the main thread, the
+   libspotify threads and the audio thread without locks.  When the
+   metrics are disabled, recording costs a single load.
+
+   The histograms have METRICS_SUB_BUCKETS buckets for each power of
+   two of microseconds, so every value is known within 1/8 of itself,
+   from microseconds to days, in a fixed amount of memory.  */
+
+#define METRICS_SUB_BITS 3
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+/* The values below this many microseconds have a bucket each.  */
+#define METRICS_LINEAR (2 * METRICS_SUB_BUCKETS)
+#define METRICS_BUCKETS (METRICS_LINEAR + 40 * METRICS_SUB_BUCKETS)
+
+struct metric
+{
+  const char *name;
+  bool histogram;
+  unsigned long count;
+  unsigned long long sum;
+  unsigned long long max;
+  unsigned long buckets[METRICS_BUCKETS];
+};
+
+static struct metric g_metrics[METRIC_COUNT] =
+  {
+    [METRIC_PROCESS_EVENTS] = {"process events", true},
+    [METRIC_MUSIC_DELIVERY] = {"music delivery", true},
+    [METRIC_AUDIO_FRAMES] = {"audio frames", false},
+    [METRIC_UNDERRUNS] = {"underruns", false},
+    [METRIC_RENDER] = {"render", true},
+    [METRIC_COVER_DECODE] = {"cover decode", true},
+    [METRIC_SEARCH] = {"search", true},
+    [METRIC_BROWSE] = {"browse", true},
+  };
+
+static bool g_enabled;
+static long long g_last_dump;
+
+static int
+bucket_of (unsigned long long us)
+{
+  int e;
+
+  if (us < METRICS_LINEAR)
+    return us;
+
+  e = 63 - __builtin_clzll (us);
+  return min (METRICS_LINEAR
+              + (e - METRICS_SUB_BITS - 1) * METRICS_SUB_BUCKETS
+              + (int) ((us >> (e - METRICS_SUB_BITS)) & (METRICS_SUB_BUCKETS - 1)),
+              METRICS_BUCKETS - 1);
+}
+
+/* The highest value that falls in bucket I.  */
+static unsigned long long
+bucket_top (int i)
+{
+  int e, sub;
+
+  if (i < METRICS_LINEAR)
+    return i;
+
+  e = (i - METRICS_LINEAR) / METRICS_SUB_BUCKETS + METRICS_SUB_BITS + 1;
+  sub = (i - METRICS_LINEAR) % METRICS_SUB_BUCKETS;
+  return ((unsigned long long) (METRICS_SUB_BUCKETS + sub + 1)
+          << (e - METRICS_SUB_BITS)) - 1;
+}
+
+static long long
+now_us ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void
+metrics_enable (bool enable)
+{
+  __atomic_store_n (&g_enabled, enable, __ATOMIC_RELAXED);
+}
+
+bool
+metrics_enabled ()
+{
+  return __atomic_load_n (&g_enabled, __ATOMIC_RELAXED);
+}
+
+long long
+metrics_start ()
+{
+  return metrics_enabled () ? now_us () : 0;
+}
+
+void
+metrics_stop (int metric, long long start)
+{
+  if (start)
+    metrics_record (metric, now_us () - start);
+}
+
+void
+metrics_count (int metric, unsigned long n)
+{
+  if (metrics_enabled ())
+    __atomic_fetch_add (&g_metrics[metric].count, n, __ATOMIC_RELAXED);
+}
+
+void
+metrics_record (int metric, long long us)
+{
+  struct metric *m = &g_metrics[metric];
+  unsigned long long value = max (us, 0), seen;
+
+  if (!metrics_enabled ())
+    return;
+
+  __atomic_fetch_add (&m->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&m->sum, value, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&m->buckets[bucket_of (value)], 1, __ATOMIC_RELAXED);
+
+  seen = __atomic_load_n (&m->max, __ATOMIC_RELAXED);
+  while (value > seen
+         && !__atomic_compare_exchange_n (&m->max, &seen, value, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+/* The value under which are FRACTION of the COUNT values of M.  */
+static unsigned long long
+percentile (struct metric *m, unsigned long count, double fraction)
+{
+  unsigned long long seen = 0, wanted = count * fraction;
+  int i;
+
+  for (i = 0; i < METRICS_BUCKETS; i++)
+    {
+      seen += __atomic_load_n (&m->buckets[i], __ATOMIC_RELAXED);
+      if (seen > wanted)
+        break;
+    }
+
+  return min (bucket_top (i), __atomic_load_n (&m->max, __ATOMIC_RELAXED));
+}
+
+static const char *
+format_us (unsigned long long us, char *buffer, size_t len)
+{
+  if (us < 1000)
+    snprintf (buffer, len, "%lluus", us);
+  else if (us < 1000000)
+    snprintf (buffer, len, "%.1fms", us / 1000.0);
+  else
+    snprintf (buffer, len, "%.1fs", us / 1000000.0);
+  return buffer;
+}
+
+/* Describe the metric I in BUFFER.  */
+int
+metrics_format (int i, char *buffer, size_t len)
+{
+  struct metric *m = &g_metrics[i];
+  unsigned long count = __atomic_load_n (&m->count, __ATOMIC_RELAXED);
+  char p50[16], p99[16], top[16];
+
+  if (!m->histogram || count == 0)
+    return snprintf (buffer, len, "%-15s %lu", m->name, count);
+
+  return snprintf (buffer, len, "%-15s %lu p50 %s p99 %s max %s", m->name,
+                   count,
+                   format_us (percentile (m, count, 0.5), p50, sizeof p50),
+                   format_us (percentile (m, count, 0.99), p99, sizeof p99),
+                   format_us (__atomic_load_n (&m->max, __ATOMIC_RELAXED),
+                              top, sizeof top));
+}
+
+/* Rewrite PATH with the metrics, every METRICS_DUMP_INTERVAL_MS while
+   they are enabled.  */
+void
+metrics_dump (const char *path)
+{
+  char tmp[PATH_MAX], line[128];
+  long long now = now_ms ();
+  FILE *f;
+  int i;
+
+  if (!metrics_enabled () || now - g_last_dump < METRICS_DUMP_INTERVAL_MS)
+    return;
+  g_last_dump = now;
+
+  snprintf (tmp, sizeof tmp, "%s.new", path);
+  f = fopen (tmp, "w");
+  if (f == NULL)
+    return;
+
+  fprintf (f, "time %ld\n", (long) time (NULL));
+  for (i = 0; i < METRIC_COUNT; i++)
+    {
+      metrics_format (i, line, sizeof line);
+      fprintf (f, "%s\n", line);
+    }
+
+  if (fclose (f) == 0)
+    rename (tmp, path);
+  else
+    unlink (tmp);
+}
@@ -0,0 +1,250 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shpotify.h"
+
+#include <string.h>
+
+/* Browses started while the cursor rests on a row, so that entering it
+   does not wait.  The completed ones are kept in a small LRU.  */
+struct prefetch_entry
+{
+  /* TYPE_ALBUM, TYPE_ARTIST or TYPE_PLAYLIST, TYPE_LAST if unused.  */
+  int type;
+  /* The sp_album, sp_artist or sp_playlist browsed.  */
+  void *key;
+  /* While loading.  */
+  struct load_request *req;
+  /* The sp_albumbrowse, sp_artistbrowse or sp_playlist once loaded.  */
+  void *object;
+  long long used;
+};
+
+static struct prefetch_entry g_entries[PREFETCH_ENTRIES];
+
+static void *
+result_key (struct search_result *sr)
+{
+  switch (sr->type)
+    {
+    case TYPE_ALBUM:
+      return sr->album;
+    case TYPE_ARTIST:
+      return sr->artist;
+    case TYPE_PLAYLIST:
+      return sr->playlist;
+    }
+
+  return NULL;
+}
+
+static void
+entry_clear (struct prefetch_entry *e)
+{
+  if (e->req)
+    load_cancel (e->req);
+
+  switch (e->type)
+    {
+    case TYPE_ALBUM:
+      sp_album_release (e->key);
+      if (e->object)
+        sp_albumbrowse_release (e->object);
+      break;
+
+    case TYPE_ARTIST:
+      sp_artist_release (e->key);
+      if (e->object)
+        sp_artistbrowse_release (e->object);
+      break;
+
+    case TYPE_PLAYLIST:
+      sp_playlist_release (e->key);
+      if (e->object)
+        sp_playlist_release (e->object);
+      break;
+    }
+
+  memset (e, 0, sizeof *e);
+}
+
+static struct prefetch_entry *
+entry_find (struct search_result *sr)
+{
+  void *key = result_key (sr);
+  int i;
+
+  for (i = 0; key && i < PREFETCH_ENTRIES; i++)
+    if (g_entries[i].type == sr->type && g_entries[i].key == key)
+      return &g_entries[i];
+
+  return NULL;
+}
+
+static void
+prefetch_loaded (void *object, sp_error error, void *data)
+{
+  struct prefetch_entry *e = data;
+
+  /* The request is freed by the loader.  */
+  e->req = NULL;
+  if (error != SP_ERROR_OK)
+    {
+      entry_clear (e);
+      return;
+    }
+
+  switch (e->type)
+    {
+    case TYPE_ALBUM:
+      sp_albumbrowse_add_ref (object);
+      break;
+    case TYPE_ARTIST:
+      sp_artistbrowse_add_ref (object);
+      break;
+    case TYPE_PLAYLIST:
+      sp_playlist_add_ref (object);
+      break;
+    }
+  e->object = object;
+}
+
+void
+prefetch_start (sp_session *session, struct search_result *sr)
+{
+  struct prefetch_entry *e, *victim = NULL, *oldest_pending = NULL;
+  int i, pending = 0;
+
+  if (result_key (sr) == NULL)
+    return;
+
+  e = entry_find (sr);
+  if (e)
+    {
+      e->used = now_ms ();
+      return;
+    }
+
+  for (i = 0; i < PREFETCH_ENTRIES; i++)
+    {
+      e = &g_entries[i];
+      if (e->req)
+        {
+          pending++;
+          if (oldest_pending == NULL || e->used < oldest_pending->used)
+            oldest_pending = e;
+          continue;
+        }
+
+      if (victim == NULL || e->type == TYPE_LAST
+          || (victim->type != TYPE_LAST && e->used < victim->used))
+        victim = e;
+    }
+
+  /* Bound the speculative work, the latest hover wins.  */
+  if (pending >= PREFETCH_MAX_PENDING || victim == NULL)
+    victim = oldest_pending;
+  entry_clear (victim);
+
+  e = victim;
+  e->type = sr->type;
+  e->key = result_key (sr);
+  e->used = now_ms ();
+  search_result_add_ref (sr);
+
+  switch (sr->type)
+    {
+    case TYPE_ALBUM:
+      e->req = load_albumbrowse (session, sr->album, TIMEOUT * 1000,
+                                 prefetch_loaded, e);
+      break;
+
+    case TYPE_ARTIST:
+      e->req = load_artistbrowse (session, sr->artist,
+                                  SP_ARTISTBROWSE_NO_TRACKS, TIMEOUT * 1000,
+                                  prefetch_loaded, e);
+      break;
+
+    case TYPE_PLAYLIST:
+      e->req = load_playlist (sr->playlist, TIMEOUT * 1000,
+                              prefetch_loaded, e);
+      break;
+    }
+
+  if (e->req == NULL)
+    entry_clear (e);
+}
+
+/* The cursor moved: forget the browses still loading, keep the loaded
+   ones.  */
+void
+prefetch_cancel ()
+{
+  int i;
+
+  for (i = 0; i < PREFETCH_ENTRIES; i++)
+    if (g_entries[i].req)
+      entry_clear (&g_entries[i]);
+}
+
+void
+prefetch_clear ()
+{
+  int i;
+
+  for (i = 0; i < PREFETCH_ENTRIES; i++)
+    if (g_entries[i].type != TYPE_LAST)
+      entry_clear (&g_entries[i]);
+}
+
+void *
+prefetch_lookup (struct search_result *sr)
+{
+  struct prefetch_entry *e = entry_find (sr);
+
+  if (e == NULL || e->object == NULL)
+    return NULL;
+
+  e->used = now_ms ();
+  return e->object;
+}
+
+struct load_request *
+prefetch_adopt (struct search_result *sr, load_cb cb, void *data)
+{
+  struct prefetch_entry *e = entry_find (sr);
+  struct load_request *req;
+
+  if (e == NULL || e->req == NULL)
+    return NULL;
+
+  req = e->req;
+  e->req = NULL;
+  entry_clear (e);
+  load_retarget (req, TIMEOUT * 1000, cb, data);
+  return req;
+}
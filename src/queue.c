@@ -37,37 +37,64 @@ struct queue_s
   size_t current_add;
   size_t used;
   size_t length;
-  sp_track *tracks[];
+  sp_track **tracks;
 };
 
 queue_t *
 queue_make (sp_session * session, size_t len)
 {
-  queue_t *q = calloc (sizeof (struct queue_s)
-		       + sizeof (sp_track *) * len, 1);
+  queue_t *q = calloc (sizeof (struct queue_s), 1);
   if (q == NULL)
     return q;
 
+  q->tracks = calloc (sizeof (sp_track *), len);
+  if (q->tracks == NULL)
+    {
+      free (q);
+      return NULL;
+    }
+
   q->session = session;
   q->length = len;
 
   return q;
 }
 
+/* Double the room of a full queue, moving the tracks to the start.  */
+static int
+queue_grow (queue_t *queue)
+{
+  size_t i, length = queue->length * 2;
+  sp_track **tracks = malloc (sizeof (sp_track *) * length);
+  if (tracks == NULL)
+    return -1;
+
+  for (i = 0; i < queue->used; i++)
+    tracks[i] = queue->tracks[(queue->current + i) % queue->length];
+
+  free (queue->tracks);
+  queue->tracks = tracks;
+  queue->length = length;
+  queue->current = 0;
+  queue->current_add = queue->used;
+  return 0;
+}
+
 int
 queue_add (queue_t *queue, sp_track * track)
 {
-  if (queue->used == queue->length)
+  if (queue->used == queue->length && queue_grow (queue) < 0)
     return 0;
 
   queue->used++;
   queue->tracks[queue->current_add] = track;
   sp_track_add_ref (track);
   queue->current_add = (queue->current_add + 1) % (queue->length);
+  return 1;
 }
 
-static void
-queue_free_list (queue_t *queue)
+void
+queue_clear (queue_t *queue)
 {
   sp_track *track;
   while ((track = queue_get_next (queue)))
@@ -77,7 +104,8 @@ queue_free_list (queue_t *queue)
 void
 queue_free (queue_t *queue)
 {
-  queue_free_list (queue);
+  queue_clear (queue);
+  free (queue->tracks);
   free (queue);
 }
 
@@ -105,7 +133,7 @@ queue_peek_next (queue_t *queue, size_t start)
 void
 queue_play_with_future (queue_t *queue, struct search_result *sr)
 {
-  queue_free_list (queue);
+  queue_clear (queue);
   while (sr->type)
     {
       if (sr->type == TYPE_TRACK)
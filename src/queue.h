@@ -34,6 +34,7 @@ typedef struct queue_s queue_t;
 queue_t *queue_make (sp_session *session, size_t len);
 int queue_add (queue_t *queue, sp_track *track);
 void queue_free (queue_t *queue);
+void queue_clear (queue_t *queue);
 /*The caller steals the reference!  */
 sp_track *queue_get_next (queue_t *queue);
 sp_track *queue_peek_next (queue_t *queue, size_t start);
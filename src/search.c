@@ -0,0 +1,641 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shpotify.h"
+
+#include <string.h>
+#include <time.h>
+
+/* Every category is searched through its own sp_search, so that each one
+   can be shown as soon as it is loaded.  */
+struct search_request
+{
+  sp_search *search;
+  int category;
+  /* Offset of the page being searched.  */
+  int offset;
+  /* Offset of the next page, and whether there may be one.  */
+  int next_offset;
+  bool more;
+  /* When the search was sent, for the metrics.  */
+  long long started;
+  /* RESULTS come from the service, not from the cache.  */
+  bool fresh;
+  /* Last results of the first page for this category, from the cache
+     or from the service.  The next pages are handed over as they
+     arrive.  */
+  struct search_result *results;
+};
+
+static sp_session *g_session;
+static struct search_request g_requests[SEARCH_CATEGORIES];
+static search_result_cb g_search_cb;
+static void *g_search_cb_data;
+static time_t g_search_start;
+static char *g_query;
+/* The results of G_QUERY go to the cache only once it is worth it: the
+   user submitted the query or dwelt on it, or it was cached already.
+   The prefixes typed on the way do not evict anything.  */
+static bool g_keep;
+static int g_count;
+/* Rows delivered so far.  */
+static size_t g_delivered;
+
+void
+search_result_release (struct search_result *sr)
+{
+  switch (sr->type)
+    {
+    case TYPE_ARTIST:
+      sp_artist_release (sr->artist);
+      break;
+
+    case TYPE_TRACK:
+      sp_track_release (sr->track);
+      break;
+
+    case TYPE_PLAYLIST:
+      sp_playlist_release (sr->playlist);
+      break;
+
+    case TYPE_ALBUM:
+      sp_album_release (sr->album);
+      break;
+    }
+}
+
+void
+free_search_results (struct search_result *sr)
+{
+  struct search_result *it = sr;
+  if (!sr)
+    return;
+  while (it->type != TYPE_LAST)
+    search_result_release (it++);
+}
+
+void
+search_result_add_ref (struct search_result *sr)
+{
+  switch (sr->type)
+    {
+    case TYPE_ARTIST:
+      sp_artist_add_ref (sr->artist);
+      break;
+
+    case TYPE_TRACK:
+      sp_track_add_ref (sr->track);
+      break;
+
+    case TYPE_PLAYLIST:
+      sp_playlist_add_ref (sr->playlist);
+      break;
+
+    case TYPE_ALBUM:
+      sp_album_add_ref (sr->album);
+      break;
+    }
+}
+
+int
+search_result_link (struct search_result *sr, char *buffer, int len)
+{
+  sp_link *link = NULL;
+  int ret;
+
+  switch (sr->type)
+    {
+    case TYPE_ARTIST:
+      link = sp_link_create_from_artist (sr->artist);
+      break;
+
+    case TYPE_TRACK:
+      link = sp_link_create_from_track (sr->track, 0);
+      break;
+
+    case TYPE_PLAYLIST:
+      link = sp_link_create_from_playlist (sr->playlist);
+      break;
+
+    case TYPE_ALBUM:
+      link = sp_link_create_from_album (sr->album);
+      break;
+    }
+
+  if (link == NULL)
+    return -1;
+
+  ret = sp_link_as_string (link, buffer, len);
+  sp_link_release (link);
+  return ret > 0 && ret < len ? 0 : -1;
+}
+
+int
+search_result_from_link (sp_session *session, const char *str,
+                         struct search_result *sr)
+{
+  sp_link *link = sp_link_create_from_string (str);
+  if (link == NULL)
+    return -1;
+
+  sr->type = TYPE_LAST;
+  switch (sp_link_type (link))
+    {
+    case SP_LINKTYPE_TRACK:
+      sr->track = sp_link_as_track (link);
+      if (sr->track)
+        {
+          sr->type = TYPE_TRACK;
+          sp_track_add_ref (sr->track);
+        }
+      break;
+
+    case SP_LINKTYPE_ALBUM:
+      sr->album = sp_link_as_album (link);
+      if (sr->album)
+        {
+          sr->type = TYPE_ALBUM;
+          sp_album_add_ref (sr->album);
+        }
+      break;
+
+    case SP_LINKTYPE_ARTIST:
+      sr->artist = sp_link_as_artist (link);
+      if (sr->artist)
+        {
+          sr->type = TYPE_ARTIST;
+          sp_artist_add_ref (sr->artist);
+        }
+      break;
+
+    case SP_LINKTYPE_PLAYLIST:
+      /* The reference is already ours.  */
+      sr->playlist = sp_playlist_create (session, link);
+      if (sr->playlist)
+        sr->type = TYPE_PLAYLIST;
+      break;
+
+    default:
+      break;
+    }
+
+  sp_link_release (link);
+  return sr->type == TYPE_LAST ? -1 : 0;
+}
+
+static struct search_result *
+search_collect (sp_search *search, int category)
+{
+  struct search_result *sr;
+  int i, n = 0;
+
+  switch (category)
+    {
+    case SEARCH_TRACKS:
+      n = sp_search_num_tracks (search);
+      break;
+    case SEARCH_ALBUMS:
+      n = sp_search_num_albums (search);
+      break;
+    case SEARCH_PLAYLISTS:
+      n = sp_search_num_playlists (search);
+      break;
+    case SEARCH_ARTISTS:
+      n = sp_search_num_artists (search);
+      break;
+    }
+
+  sr = calloc ((n + 1) * sizeof (struct search_result), 1);
+  if (sr == NULL)
+    return NULL;
+
+  for (i = 0; i < n; i++)
+    {
+      switch (category)
+        {
+        case SEARCH_TRACKS:
+          sr[i].type = TYPE_TRACK;
+          sr[i].track = sp_search_track (search, i);
+          break;
+
+        case SEARCH_ALBUMS:
+          sr[i].type = TYPE_ALBUM;
+          sr[i].album = sp_search_album (search, i);
+          break;
+
+        case SEARCH_PLAYLISTS:
+          sr[i].type = TYPE_PLAYLIST;
+          sr[i].playlist = sp_search_playlist (search, i);
+          break;
+
+        case SEARCH_ARTISTS:
+          sr[i].type = TYPE_ARTIST;
+          sr[i].artist = sp_search_artist (search, i);
+          break;
+        }
+      search_result_add_ref (&sr[i]);
+    }
+
+  return sr;
+}
+
+/* Links for the search cache, NULL if any of them is not available.  */
+static char **
+search_links (struct search_result *sr, int *n_links)
+{
+  char buffer[256];
+  char **links;
+  int i, n = 0;
+
+  while (sr[n].type)
+    n++;
+
+  links = calloc (n + 1, sizeof (char *));
+  if (links == NULL)
+    return NULL;
+
+  for (i = 0; i < n; i++)
+    {
+      if (search_result_link (&sr[i], buffer, sizeof buffer) < 0)
+        break;
+      links[i] = strdup (buffer);
+    }
+
+  if (i < n)
+    {
+      while (i--)
+        free (links[i]);
+      free (links);
+      return NULL;
+    }
+
+  *n_links = n;
+  return links;
+}
+
+static struct search_result *
+search_from_links (char **links, int n_links)
+{
+  struct search_result *sr;
+  int i, n = 0;
+
+  sr = calloc ((n_links + 1) * sizeof (struct search_result), 1);
+  if (sr == NULL)
+    return NULL;
+
+  for (i = 0; i < n_links; i++)
+    if (search_result_from_link (g_session, links[i], &sr[n]) == 0)
+      n++;
+
+  return sr;
+}
+
+/* Deliver the results of every category, in a fixed order.  */
+static void
+search_deliver ()
+{
+  struct search_result *sr;
+  size_t i, j, n = 0;
+
+  for (i = 0; i < SEARCH_CATEGORIES; i++)
+    for (j = 0; g_requests[i].results && g_requests[i].results[j].type; j++)
+      n++;
+
+  sr = calloc ((n + 1) * sizeof (struct search_result), 1);
+  if (sr == NULL)
+    return;
+
+  n = 0;
+  for (i = 0; i < SEARCH_CATEGORIES; i++)
+    for (j = 0; g_requests[i].results && g_requests[i].results[j].type; j++)
+      {
+        sr[n] = g_requests[i].results[j];
+        search_result_add_ref (&sr[n++]);
+      }
+
+  g_delivered = n;
+  if (g_search_cb)
+    g_search_cb (sr, 0, g_search_cb_data);
+  else
+    {
+      free_search_results (sr);
+      free (sr);
+    }
+}
+
+static int
+search_count (struct search_result *sr)
+{
+  int n = 0;
+
+  while (sr[n].type)
+    n++;
+
+  return n;
+}
+
+/* Append a page after the rows delivered so far.  SR is handed over.  */
+static void
+search_append (struct search_request *req, struct search_result *sr)
+{
+  int n = search_count (sr);
+
+  req->next_offset = req->offset + n;
+  req->more = n == g_count;
+  if (n == 0 || g_search_cb == NULL)
+    {
+      free_search_results (sr);
+      free (sr);
+      return;
+    }
+
+  g_delivered += n;
+  g_search_cb (sr, g_delivered - n, g_search_cb_data);
+}
+
+static void
+search_complete (sp_search *result, void *userdata)
+{
+  struct search_request *req = userdata;
+  struct search_result *sr;
+  bool changed = true;
+  char **links;
+  int n_links;
+
+  /* Cancelled or superseded by a newer query.  */
+  if (req->search != result)
+    return;
+
+  metrics_stop (METRIC_SEARCH, req->started);
+  trace_async_end ("search", req);
+
+  if (sp_search_error (result) == SP_ERROR_OK)
+    sr = search_collect (result, req->category);
+  else
+    sr = NULL;
+
+  sp_search_release (result);
+  req->search = NULL;
+
+  if (sr == NULL)
+    return;
+
+  links = g_keep ? search_links (sr, &n_links) : NULL;
+  if (links)
+    changed = cache_store (g_query, req->category, req->offset, links,
+                           n_links)
+      || req->results == NULL;
+
+  if (req->offset)
+    {
+      search_append (req, sr);
+      return;
+    }
+
+  req->next_offset = search_count (sr);
+  req->more = req->next_offset == g_count;
+  req->fresh = true;
+
+  if (!changed)
+    {
+      free_search_results (sr);
+      free (sr);
+      return;
+    }
+
+  if (req->results)
+    {
+      free_search_results (req->results);
+      free (req->results);
+    }
+  req->results = sr;
+  search_deliver ();
+}
+
+static sp_search *
+search_create (sp_session *session, const char *query, int category,
+               int offset, int count, struct search_request *req)
+{
+  sp_search *search;
+
+  req->started = metrics_start ();
+  search = sp_search_create (session, query,
+                             offset, category == SEARCH_TRACKS ? count : 0,
+                             offset, category == SEARCH_ALBUMS ? count : 0,
+                             offset, category == SEARCH_ARTISTS ? count : 0,
+                             offset, category == SEARCH_PLAYLISTS ? count : 0,
+                             SP_SEARCH_STANDARD, search_complete, req);
+  if (search)
+    trace_async_begin ("search", req);
+  return search;
+}
+
+int
+search_start (sp_session *session, const char *query, int categories,
+              int count, search_result_cb cb, void *data)
+{
+  bool cached = false;
+  int i;
+
+  search_cancel ();
+
+  g_session = session;
+  g_search_cb = cb;
+  g_search_cb_data = data;
+  g_search_start = time (NULL);
+  free (g_query);
+  g_query = strdup (query);
+  g_count = count;
+  g_delivered = 0;
+  g_keep = false;
+
+  for (i = 0; i < SEARCH_CATEGORIES; i++)
+    {
+      struct search_request *req = &g_requests[i];
+      char **links;
+      int n_links;
+
+      if (!(categories & (1 << i)))
+        continue;
+
+      req->category = 1 << i;
+      req->offset = 0;
+      req->fresh = false;
+
+      /* Show the cached results immediately, the search below
+         revalidates them.  */
+      links = cache_lookup (query, req->category, 0, &n_links);
+      if (links)
+        {
+          req->results = search_from_links (links, n_links);
+          cached = true;
+        }
+
+      req->search = search_create (session, query, req->category, 0, count,
+                                   req);
+      if (req->search == NULL)
+        {
+          search_cancel ();
+          return -1;
+        }
+    }
+
+  if (cached)
+    {
+      g_keep = true;
+      search_deliver ();
+    }
+
+  return 0;
+}
+
+void
+search_keep ()
+{
+  int i;
+
+  if (g_keep || g_query == NULL)
+    return;
+  g_keep = true;
+
+  /* The first pages already in, the next ones are stored as they
+     arrive.  */
+  for (i = 0; i < SEARCH_CATEGORIES; i++)
+    {
+      struct search_request *req = &g_requests[i];
+      char **links;
+      int n_links;
+
+      if (!req->fresh || req->results == NULL)
+        continue;
+
+      links = search_links (req->results, &n_links);
+      if (links)
+        cache_store (g_query, req->category, 0, links, n_links);
+    }
+}
+
+void
+search_cancel ()
+{
+  int i;
+
+  g_search_cb = NULL;
+  for (i = 0; i < SEARCH_CATEGORIES; i++)
+    {
+      g_requests[i].more = false;
+
+      if (g_requests[i].search)
+        {
+          trace_async_end ("search", &g_requests[i]);
+          sp_search_release (g_requests[i].search);
+          g_requests[i].search = NULL;
+        }
+
+      if (g_requests[i].results)
+        {
+          free_search_results (g_requests[i].results);
+          free (g_requests[i].results);
+          g_requests[i].results = NULL;
+        }
+    }
+}
+
+/* Ask the next page of every category whose last page was full, once
+   the previous pages are all in.  Return the number of pages asked.  */
+int
+search_more ()
+{
+  int i, ret = 0;
+
+  if (g_search_cb == NULL || search_pending ())
+    return 0;
+
+  for (i = 0; i < SEARCH_CATEGORIES; i++)
+    {
+      struct search_request *req = &g_requests[i];
+      char **links;
+      int n_links;
+
+      if (!req->more)
+        continue;
+
+      req->more = false;
+      req->offset = req->next_offset;
+
+      /* Pages are not revalidated, the cache expiry is enough.  */
+      links = cache_lookup (g_query, req->category, req->offset, &n_links);
+      if (links)
+        {
+          struct search_result *sr = search_from_links (links, n_links);
+          if (sr)
+            {
+              search_append (req, sr);
+              ret++;
+              continue;
+            }
+        }
+
+      req->search = search_create (g_session, g_query, req->category,
+                                   req->offset, g_count, req);
+      if (req->search)
+        ret++;
+    }
+
+  g_search_start = time (NULL);
+  return ret;
+}
+
+int
+search_pending ()
+{
+  int i, ret = 0;
+
+  for (i = 0; i < SEARCH_CATEGORIES; i++)
+    if (g_requests[i].search)
+      ret++;
+
+  return ret;
+}
+
+void
+search_process ()
+{
+  int i;
+
+  /* Keep the results already delivered.  */
+  if (search_pending () && time (NULL) - g_search_start > TIMEOUT)
+    for (i = 0; i < SEARCH_CATEGORIES; i++)
+      if (g_requests[i].search)
+        {
+          /* Timed out, its time is recorded as if it completed.  */
+          metrics_stop (METRIC_SEARCH, g_requests[i].started);
+          trace_async_end ("search", &g_requests[i]);
+          sp_search_release (g_requests[i].search);
+          g_requests[i].search = NULL;
+        }
+}
@@ -34,6 +34,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define TIMEOUT 10
 
+#define SEARCH_CACHE_ENTRIES 64
+#define SEARCH_CACHE_TTL (24 * 60 * 60)
+#define SEARCH_DEBOUNCE_MS 300
+/* A query typed and left alone this long is stored in the cache.  */
+#define SEARCH_DWELL_MS 2000
+/* Rows added to a big list on every iteration of the main loop.  */
+#define FILL_CHUNK 500
+/* Rows kept with their libspotify object around the ones shown.  */
+#define LIST_KEEP_ROWS 500
+
 #define max(a,b) ((a) > (b) ? (a) : (b))
 #define min(a,b) ((a) < (b) ? (a) : (b))
 
@@ -47,9 +57,10 @@ enum
     STATUS_SEARCH_BROWSE,
     STATUS_BROWSE_SHOW,
     STATUS_BROWSE_SHOW_PLAYLISTS,
-    STATUS_BROWSE_RESULT,
-    STATUS_SEARCH_BROWSE_PLAYLIST,
-    STATUS_PLAYING
+    STATUS_LOADING,
+    STATUS_PLAYING,
+    STATUS_CHOOSE_PLAYLIST,
+    STATUS_SEARCH_INPUT
   };
 
 enum
@@ -72,6 +83,9 @@ enum
     TYPE_PLAYLIST = 4,
     TYPE_PLAYLISTCONTAINER_START = 5,
     TYPE_PLAYLISTCONTAINER_END = 6,
+    /* A result whose object was released to save memory, only its
+       link is left.  */
+    TYPE_LINK = 7,
   };
 
 struct search_result
@@ -83,22 +97,362 @@ struct search_result
     sp_artist *artist;
     sp_playlist *playlist;
     char folder[32];
+    const char *link;
   };
   int type;
 };
 
 extern int g_h, g_w;
 
-int sound_init ();
+long long now_ms ();
+
+/* The device is opened on the first playback.  */
+const char *sound_error ();
 int sound_write (const char *buffer, int frames);
 int sound_flush ();
 int sound_clean ();
 int sound_pause (int);
 unsigned int sound_get_buffer ();
 
+/* container.c.  */
+void container_start (sp_session *session);
+void container_stop ();
+/* One row per entry of the container, NULL until it is loaded.  The
+   rows belong to the model and change with the container: the array is
+   valid until container_generation changes.  */
+struct search_result *container_rows ();
+const unsigned char *container_levels ();
+unsigned long container_generation ();
+
+/* control.c.  */
+#define CONTROL_SOCKET "control"
+#define CONTROL_MAX_CLIENTS 32
+#define CONTROL_LINE_MAX 4096
+/* Replies and events waiting for a client to read them.  */
+#define CONTROL_OUT_MAX (64 * 1024)
+
+/* Run the command LINE, write a reply line without the newline in
+   REPLY.  */
+typedef void (*control_handler) (char *line, char *reply, size_t len);
+
+int control_start (const char *path, control_handler handler);
+void control_stop ();
+/* Serve the clients, waiting at most TIMEOUT ms.  */
+void control_poll (int timeout);
+/* Send "event <FMT>" to the subscribed clients.  */
+void control_event (const char *fmt, ...);
+
+/* frame.c.  */
+#define FRAME_RATE_MAX 30
+#define FRAME_RATE_LOW 5
+#define FRAME_BYTES_LOW 2048
+/* Seconds between two updates of the elapsed time in the low-bandwidth
+   mode.  */
+#define FRAME_PROGRESS_STEP_LOW 5
+
+void frame_init ();
+/* Something was staged with wnoutrefresh outside of stdscr.  */
+void frame_damage ();
+/* Send the changes to the terminal, unless the last frame is too recent.
+   Return the ms to wait before the changes can be sent, 0 when they were
+   sent or there was nothing to send.  */
+int frame_flush ();
+/* Flush the frame and read a key, waiting at most TIMEOUT_MS.  */
+int frame_getch (int timeout_ms);
+FILE *frame_tty ();
+unsigned long long frame_tty_bytes ();
+void frame_set_low_bandwidth (bool low);
+bool frame_low_bandwidth ();
+int frame_budget ();
+
 /* img.c.  */
+/* Rough cost of a cell of the album art on the terminal.  */
+#define IMG_BYTES_PER_CELL 10
+#define IMG_MIN_SIZE 8
+
 void img_initialize_palette ();
-int img_show_art (FILE *infile);
+/* Draw the album art in at most MAX_CELLS cells, 0 for no limit.  */
+int img_show_art (FILE *infile, int max_cells);
+
+/* arena.c.  */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+/* Memory released all at once.  A zeroed struct is an empty arena.  */
+struct arena
+{
+  struct arena_chunk *chunks;
+  struct arena_chunk *last;
+  /* Chunk the next allocation is tried from.  */
+  struct arena_chunk *current;
+};
+
+/* The memory returned is zeroed.  */
+void *arena_alloc (struct arena *a, size_t size);
+void arena_reset (struct arena *a);
+
+/* listview.c.  */
+struct listview;
+
+/* Draw ROW of the list on the screen line Y.  */
+typedef void (*listview_draw_cb) (struct listview *lv, size_t row, int y,
+                                  bool selected, void *data);
+
+/* A scrollable list that only knows the number of its rows, the rows
+   themselves are drawn on demand by DRAW_ROW.  */
+struct listview
+{
+  int y, x, h, w;
+  size_t count;
+  size_t cursor;
+  /* First visible row.  */
+  size_t top;
+  listview_draw_cb draw_row;
+  void *data;
+};
+
+void listview_init (struct listview *lv, int y, int x, int h, int w,
+                    listview_draw_cb draw_row, void *data);
+void listview_set_count (struct listview *lv, size_t count);
+void listview_set_cursor (struct listview *lv, size_t cursor);
+bool listview_key (struct listview *lv, int c);
+void listview_draw_row (struct listview *lv, size_t row);
+void listview_draw (struct listview *lv);
+
+/* export.c.  */
+#define EXPORT_PARALLEL 16
+/* How long to wait for the metadata of the tracks of a loaded
+   playlist.  */
+#define EXPORT_TRACKS_TIMEOUT_MS (20 * 1000)
+#define EXPORT_FOLDER_MAX 256
+
+enum
+  {
+    EXPORT_JSONL,
+    EXPORT_CSV
+  };
+
+void export_start (sp_session *session, FILE *out, int format);
+/* Return true once every playlist was written.  */
+bool export_process ();
+
+/* filter.c.  */
+struct filter
+{
+  /* Lowercased names of the rows, one after the other.  */
+  char *text;
+  /* Start of every name in TEXT, and the end of the last one.  */
+  size_t *offsets;
+  size_t n;
+  /* Rows matching the last query, the best first.  */
+  size_t *rows;
+  size_t n_rows;
+  int *scores;
+};
+
+int filter_init (struct filter *f, const char *const *names, size_t n);
+size_t filter_apply (struct filter *f, const char *query);
+void filter_free (struct filter *f);
+
+/* starred.c.  */
+void starred_start (sp_session *session);
+void starred_stop ();
+void starred_process ();
+bool starred_contains (sp_track *track);
+/* Star or unstar TRACKS, the change is visible immediately.  */
+void starred_set (sp_track *const *tracks, int n, bool star);
+/* Changes every time the set of starred tracks changes.  */
+unsigned long starred_generation ();
+
+/* search.c.  */
+enum
+  {
+    SEARCH_TRACKS = 1 << 0,
+    SEARCH_ALBUMS = 1 << 1,
+    SEARCH_PLAYLISTS = 1 << 2,
+    SEARCH_ARTISTS = 1 << 3,
+    SEARCH_ALL = (1 << 4) - 1,
+    /* The local index, not the service.  */
+    SEARCH_LIBRARY = 1 << 4
+  };
+#define SEARCH_CATEGORIES 4
+
+/* Rows of a search result set to ask more pages for.  */
+#define SEARCH_PAGE_AHEAD 10
+
+/* Called every time a category is loaded or changes, and for every new
+   page.  RESULTS replaces the results delivered so far from the row AT
+   on: AT is 0 for the first page of every category, and the number of
+   rows delivered so far for the next pages, which are appended.  The
+   callee owns the TYPE_LAST terminated array.  */
+typedef void (*search_result_cb) (struct search_result *results, size_t at,
+                                  void *data);
+
+int search_start (sp_session *session, const char *query, int categories,
+                  int count, search_result_cb cb, void *data);
+void search_cancel ();
+/* Store the results of the current query in the cache, now and as
+   they arrive.  */
+void search_keep ();
+int search_more ();
+int search_pending ();
+void search_process ();
+/* Release the objects referenced by SR, not SR itself.  */
+void free_search_results (struct search_result *sr);
+void search_result_add_ref (struct search_result *sr);
+void search_result_release (struct search_result *sr);
+int search_result_link (struct search_result *sr, char *buffer, int len);
+int search_result_from_link (sp_session *session, const char *link,
+                             struct search_result *sr);
+
+/* loader.c.  */
+#define LOAD_ERROR_TIMEOUT -1
+
+struct load_request;
+
+/* OBJECT is the loaded sp_playlist, sp_playlistcontainer,
+   sp_albumbrowse or sp_artistbrowse, valid only during the call.  It is
+   not called for cancelled requests.  */
+typedef void (*load_cb) (void *object, sp_error error, void *data);
+
+struct load_request *load_playlist (sp_playlist *pl, int timeout,
+                                    load_cb cb, void *data);
+struct load_request *load_container (sp_playlistcontainer *pc, int timeout,
+                                     load_cb cb, void *data);
+struct load_request *load_albumbrowse (sp_session *session, sp_album *album,
+                                       int timeout, load_cb cb, void *data);
+struct load_request *load_artistbrowse (sp_session *session,
+                                        sp_artist *artist,
+                                        sp_artistbrowse_type type,
+                                        int timeout, load_cb cb, void *data);
+void load_cancel (struct load_request *req);
+void load_retarget (struct load_request *req, int timeout, load_cb cb,
+                    void *data);
+void load_process ();
+int load_describe (struct load_request *req, char *buffer, size_t len);
+
+/* prefetch.c.  */
+/* The cursor must rest on a row this long before it is prefetched.  */
+#define PREFETCH_DWELL_MS 400
+#define PREFETCH_ENTRIES 8
+#define PREFETCH_MAX_PENDING 2
+
+void prefetch_start (sp_session *session, struct search_result *sr);
+void prefetch_cancel ();
+void prefetch_clear ();
+/* The loaded sp_albumbrowse, sp_artistbrowse or sp_playlist for SR, valid
+   until the next prefetch call, or NULL.  */
+void *prefetch_lookup (struct search_result *sr);
+/* Take over the prefetch of SR if it is still loading, NULL otherwise.  */
+struct load_request *prefetch_adopt (struct search_result *sr, load_cb cb,
+                                     void *data);
+
+/* library.c.  */
+/* Tracks indexed at every iteration of the main loop.  */
+#define LIBRARY_CHUNK 200
+/* Delay before the playlists are walked again, shorter when some
+   tracks were not loaded yet.  */
+#define LIBRARY_RESCAN_MS (10 * 60 * 1000)
+#define LIBRARY_RETRY_MS (5 * 1000)
+#define LIBRARY_MAX_RESULTS 500
+
+void library_start (sp_session *session);
+void library_stop ();
+void library_process ();
+/* The links of the indexed tracks matching QUERY, at most MAX,
+   allocated in A.  */
+struct search_result *library_search (const char *query, struct arena *a,
+                                      int max);
+
+/* import.c.  */
+#define IMPORT_MAX_PENDING 200
+#define IMPORT_BATCH 100
+#define IMPORT_READ_CHUNK 50
+#define IMPORT_TIMEOUT_MS (30 * 1000)
+#define IMPORT_LINK_MAX 128
+/* The links that could not be added, in ~/.shpotify.  */
+#define IMPORT_LOG "import.log"
+
+struct queue_s;
+
+/* Add the tracks of the file PATH to PL, or to QUEUE if PL is NULL.  */
+int import_start (sp_session *session, const char *path, sp_playlist *pl,
+                  struct queue_s *queue);
+void import_cancel ();
+void import_process ();
+/* Describe the import in BUFFER, DONE is set once when it is over.
+   Return -1 if there is nothing to report.  */
+int import_progress (char *buffer, size_t len, bool *done);
+
+/* metrics.c.  */
+#define METRICS_FILE "stats"
+#define METRICS_DUMP_INTERVAL_MS (10 * 1000)
+
+enum
+  {
+    METRIC_PROCESS_EVENTS,
+    METRIC_MUSIC_DELIVERY,
+    METRIC_AUDIO_FRAMES,
+    /* ALSA underruns recovered in sound_write.  */
+    METRIC_UNDERRUNS,
+    METRIC_RENDER,
+    METRIC_COVER_DECODE,
+    METRIC_SEARCH,
+    METRIC_BROWSE,
+    METRIC_COUNT
+  };
+
+void metrics_enable (bool enable);
+bool metrics_enabled ();
+/* Return the start of a measure, 0 when the metrics are disabled.  */
+long long metrics_start ();
+/* Record the microseconds since START in the histogram METRIC.  */
+void metrics_stop (int metric, long long start);
+void metrics_record (int metric, long long us);
+void metrics_count (int metric, unsigned long n);
+int metrics_format (int metric, char *buffer, size_t len);
+void metrics_dump (const char *path);
+
+/* trace.c.  */
+/* Events each thread may record before the writer drains them.  */
+#define TRACE_BUFFER_EVENTS 8192
+#define TRACE_FLUSH_INTERVAL_MS 100
+
+int trace_start (const char *path);
+void trace_stop ();
+/* Return the start of a span, 0 when not tracing.  NAME must be a
+   string that is never freed: it is written later by another
+   thread.  */
+long long trace_begin ();
+void trace_end (const char *name, long long start);
+/* Spans that begin and end in different calls, matched by ID.  */
+void trace_async_begin (const char *name, const void *id);
+void trace_async_end (const char *name, const void *id);
+void trace_instant (const char *name);
+
+/* meta.c.  */
+#define META_MAX_ENTRIES 50000
+#define META_MAX_POOL (4 * 1024 * 1024)
+/* Names kept in memory before meta_process writes them out, and the
+   minimum interval between two writes.  */
+#define META_SAVE_PENDING 4096
+#define META_SAVE_INTERVAL_MS (60 * 1000)
+
+/* PATH is NULL to keep the names for this run only.  */
+void meta_init (const char *path);
+void meta_save ();
+/* Called when the main loop is idle.  */
+void meta_process ();
+/* The name SR had in a previous run, or NULL.  */
+const char *meta_name (struct search_result *sr);
+/* Record the names of SR if its metadata is loaded.  */
+void meta_remember (struct search_result *sr);
 
+/* cache.c.  */
+void cache_init (const char *path, int max_entries, int ttl);
+char **cache_lookup (const char *query, int type, int offset, int *n_links);
+int cache_store (const char *query, int type, int offset, char **links,
+                 int n_links);
+void cache_save ();
+void cache_stats (unsigned long *hits, unsigned long *misses);
 
 #endif
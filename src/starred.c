@@ -0,0 +1,305 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "shpotify.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Set of the starred tracks, keyed by the sp_track pointer.  The
+   starred playlist holds a reference to every track in it, so the
+   pointers stay valid while they are in the set.  A track starred here
+   is in the set before the playlist has it: it holds a reference of
+   its own, in HELD, until the set is built again from the playlist.  */
+
+#define TOMBSTONE ((sp_track *) 1)
+
+static sp_session *g_session;
+static sp_playlist *g_starred;
+static sp_track **g_slots;
+static size_t g_n_slots;
+static size_t g_used;
+static bool g_ready;
+/* The playlist changed in a way the set cannot follow incrementally.  */
+static bool g_rebuild;
+static unsigned long g_generation;
+static sp_track **g_held;
+static size_t g_n_held, g_held_allocated;
+
+static size_t
+slot_of (sp_track *track)
+{
+  uintptr_t h = (uintptr_t) track >> 4;
+  h *= (uintptr_t) 0x9e3779b97f4a7c15ULL;
+  return h & (g_n_slots - 1);
+}
+
+static sp_track **
+lookup (sp_track *track, bool insert)
+{
+  sp_track **free_slot = NULL;
+  size_t i;
+
+  if (g_n_slots == 0)
+    return NULL;
+
+  for (i = slot_of (track); g_slots[i]; i = (i + 1) & (g_n_slots - 1))
+    {
+      if (g_slots[i] == track)
+        return &g_slots[i];
+      if (g_slots[i] == TOMBSTONE && free_slot == NULL)
+        free_slot = &g_slots[i];
+    }
+
+  if (!insert)
+    return NULL;
+
+  return free_slot ? free_slot : &g_slots[i];
+}
+
+static int
+resize (size_t n)
+{
+  sp_track **old = g_slots;
+  size_t i, old_n = g_n_slots;
+
+  for (g_n_slots = 64; g_n_slots < n * 2; g_n_slots *= 2)
+    ;
+
+  g_slots = calloc (g_n_slots, sizeof *g_slots);
+  if (g_slots == NULL)
+    {
+      g_slots = old;
+      g_n_slots = old_n;
+      return -1;
+    }
+
+  g_used = 0;
+  for (i = 0; i < old_n; i++)
+    if (old[i] && old[i] != TOMBSTONE)
+      {
+        *lookup (old[i], true) = old[i];
+        g_used++;
+      }
+
+  free (old);
+  return 0;
+}
+
+static void
+add (sp_track *track)
+{
+  sp_track **slot;
+
+  /* Tombstones count as used, so a lookup always finds an empty slot.  */
+  if ((g_used + 1) * 4 > g_n_slots * 3 && resize (g_used + 1) < 0)
+    return;
+
+  slot = lookup (track, true);
+  if (*slot == track)
+    return;
+
+  if (*slot == NULL)
+    g_used++;
+  *slot = track;
+}
+
+static int
+hold (sp_track *track)
+{
+  if (g_n_held == g_held_allocated)
+    {
+      size_t n = max (g_held_allocated * 2, 16);
+      sp_track **held = realloc (g_held, n * sizeof *held);
+      if (held == NULL)
+        return -1;
+      g_held = held;
+      g_held_allocated = n;
+    }
+
+  sp_track_add_ref (track);
+  g_held[g_n_held++] = track;
+  return 0;
+}
+
+static void
+release_held ()
+{
+  size_t i;
+
+  for (i = 0; i < g_n_held; i++)
+    sp_track_release (g_held[i]);
+  g_n_held = 0;
+}
+
+static void
+rebuild ()
+{
+  int i, n = sp_playlist_num_tracks (g_starred);
+
+  free (g_slots);
+  g_slots = NULL;
+  g_n_slots = 0;
+  if (resize (n) < 0)
+    return;
+
+  for (i = 0; i < n; i++)
+    add (sp_playlist_track (g_starred, i));
+  release_held ();
+
+  g_ready = true;
+  g_rebuild = false;
+  g_generation++;
+}
+
+static void
+tracks_added (sp_playlist *pl, sp_track *const *tracks, int num_tracks,
+              int position, void *userdata)
+{
+  int i;
+
+  if (!g_ready)
+    return;
+
+  for (i = 0; i < num_tracks; i++)
+    add (tracks[i]);
+  g_generation++;
+}
+
+static void
+tracks_removed (sp_playlist *pl, const int *tracks, int num_tracks,
+                void *userdata)
+{
+  g_rebuild = true;
+}
+
+static void
+playlist_state_changed (sp_playlist *pl, void *userdata)
+{
+  if (!g_ready && sp_playlist_is_loaded (pl))
+    g_rebuild = true;
+}
+
+static sp_playlist_callbacks g_callbacks =
+  {
+    .tracks_added = tracks_added,
+    .tracks_removed = tracks_removed,
+    .playlist_state_changed = playlist_state_changed
+  };
+
+void
+starred_start (sp_session *session)
+{
+  starred_stop ();
+
+  g_session = session;
+  g_starred = sp_session_starred_create (session);
+  if (g_starred == NULL)
+    return;
+
+  sp_playlist_add_callbacks (g_starred, &g_callbacks, NULL);
+  g_rebuild = sp_playlist_is_loaded (g_starred);
+}
+
+void
+starred_stop ()
+{
+  if (g_starred)
+    {
+      sp_playlist_remove_callbacks (g_starred, &g_callbacks, NULL);
+      sp_playlist_release (g_starred);
+      g_starred = NULL;
+    }
+
+  free (g_slots);
+  g_slots = NULL;
+  g_n_slots = 0;
+  g_used = 0;
+  release_held ();
+  free (g_held);
+  g_held = NULL;
+  g_held_allocated = 0;
+  g_ready = false;
+  g_rebuild = false;
+  g_generation++;
+}
+
+void
+starred_process ()
+{
+  if (g_starred && g_rebuild && sp_playlist_is_loaded (g_starred))
+    rebuild ();
+}
+
+bool
+starred_contains (sp_track *track)
+{
+  sp_track **slot;
+
+  /* Until the starred playlist is loaded, ask libspotify.  */
+  if (!g_ready)
+    return g_session && sp_track_is_starred (g_session, track);
+
+  slot = lookup (track, false);
+  return slot != NULL;
+}
+
+void
+starred_set (sp_track *const *tracks, int n, bool star)
+{
+  int i;
+
+  if (g_session == NULL || n == 0)
+    return;
+
+  sp_track_set_starred (g_session, tracks, n, star);
+
+  /* Show the change now, the playlist callbacks confirm it later.  */
+  if (g_ready)
+    for (i = 0; i < n; i++)
+      {
+        if (star)
+          {
+            if (lookup (tracks[i], false) == NULL && hold (tracks[i]) == 0)
+              add (tracks[i]);
+          }
+        else
+          {
+            sp_track **slot = lookup (tracks[i], false);
+            if (slot)
+              *slot = TOMBSTONE;
+          }
+      }
+  g_generation++;
+}
+
+unsigned long
+starred_generation ()
+{
+  return g_generation;
+}
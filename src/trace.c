@@ -0,0 +1,305 @@
+/*
+  Copyright (c) 2012, Giuseppe Scrivano <gscrivano@gnu.org>
+  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of Spotify AB nor the names of its contributors
+    * may be used to endorse or promote products derived from this
+    * software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#define _GNU_SOURCE
+
+#include "shpotify.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Chrome trace events, the JSON array format read by chrome://tracing
+   and Perfetto.
+
+   Every thread records its events in its own ring, without locks or
+   system calls: the thread only moves the head, the writer thread only
+   moves the tail.  The writer drains the rings every
+   TRACE_FLUSH_INTERVAL_MS, so the file is never written from the
+   libspotify or the audio threads.  When a ring is full, the events
+   are dropped and counted.  The rings are never freed, a thread may be
+   recording into one while the trace stops.  */
+
+struct trace_event
+{
+  const char *name;
+  char phase;
+  long long ts, dur;
+  uintptr_t id;
+};
+
+struct trace_buffer
+{
+  struct trace_buffer *next;
+  pid_t tid;
+  bool named;
+  unsigned long head, tail;
+  unsigned long dropped;
+  struct trace_event events[TRACE_BUFFER_EVENTS];
+};
+
+static bool g_tracing;
+static FILE *g_out;
+static bool g_first = true;
+static pid_t g_pid;
+static __thread struct trace_buffer *t_buffer;
+
+/* G_BUFFERS only grows, under G_LOCK.  */
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_wake = PTHREAD_COND_INITIALIZER;
+static struct trace_buffer *g_buffers;
+static pthread_t g_writer;
+static bool g_stopping;
+
+static long long
+now_us ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static struct trace_buffer *
+thread_buffer ()
+{
+  struct trace_buffer *b = t_buffer;
+
+  if (b)
+    return b;
+
+  b = calloc (1, sizeof *b);
+  if (b == NULL)
+    return NULL;
+  b->tid = syscall (SYS_gettid);
+
+  pthread_mutex_lock (&g_lock);
+  b->next = g_buffers;
+  g_buffers = b;
+  pthread_mutex_unlock (&g_lock);
+
+  t_buffer = b;
+  return b;
+}
+
+static void
+push (const char *name, char phase, long long ts, long long dur,
+      uintptr_t id)
+{
+  struct trace_buffer *b = thread_buffer ();
+  struct trace_event *e;
+  unsigned long head;
+
+  if (b == NULL)
+    return;
+
+  head = b->head;
+  if (head - __atomic_load_n (&b->tail, __ATOMIC_ACQUIRE)
+      == TRACE_BUFFER_EVENTS)
+    {
+      __atomic_fetch_add (&b->dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+
+  e = &b->events[head % TRACE_BUFFER_EVENTS];
+  e->name = name;
+  e->phase = phase;
+  e->ts = ts;
+  e->dur = dur;
+  e->id = id;
+  __atomic_store_n (&b->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void
+write_separator ()
+{
+  fputs (g_first ? "[\n" : ",\n", g_out);
+  g_first = false;
+}
+
+static void
+write_event (struct trace_buffer *b, struct trace_event *e)
+{
+  write_separator ();
+  switch (e->phase)
+    {
+    case 'X':
+      fprintf (g_out, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lld,"
+               "\"dur\":%lld,\"pid\":%d,\"tid\":%d}",
+               e->name, e->ts, e->dur, g_pid, b->tid);
+      break;
+
+    case 'b':
+    case 'e':
+      fprintf (g_out, "{\"name\":\"%s\",\"cat\":\"shpotify\",\"ph\":\"%c\","
+               "\"id\":\"0x%lx\",\"ts\":%lld,\"pid\":%d,\"tid\":%d}",
+               e->name, e->phase, (unsigned long) e->id, e->ts, g_pid,
+               b->tid);
+      break;
+
+    default:
+      fprintf (g_out, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\","
+               "\"ts\":%lld,\"pid\":%d,\"tid\":%d}",
+               e->name, e->ts, g_pid, b->tid);
+      break;
+    }
+}
+
+static void
+drain ()
+{
+  struct trace_buffer *b, *buffers;
+
+  pthread_mutex_lock (&g_lock);
+  buffers = g_buffers;
+  pthread_mutex_unlock (&g_lock);
+
+  for (b = buffers; b; b = b->next)
+    {
+      unsigned long tail = b->tail;
+      unsigned long head = __atomic_load_n (&b->head, __ATOMIC_ACQUIRE);
+
+      if (!b->named)
+        {
+          write_separator ();
+          fprintf (g_out, "{\"name\":\"thread_name\",\"ph\":\"M\","
+                   "\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                   g_pid, b->tid, b->tid == g_pid ? "main" : "libspotify");
+          b->named = true;
+        }
+
+      for (; tail != head; tail++)
+        write_event (b, &b->events[tail % TRACE_BUFFER_EVENTS]);
+      __atomic_store_n (&b->tail, tail, __ATOMIC_RELEASE);
+    }
+
+  fflush (g_out);
+}
+
+static void *
+writer (void *data)
+{
+  pthread_mutex_lock (&g_lock);
+  while (!g_stopping)
+    {
+      struct timespec ts;
+
+      clock_gettime (CLOCK_REALTIME, &ts);
+      ts.tv_nsec += TRACE_FLUSH_INTERVAL_MS * 1000000L;
+      ts.tv_sec += ts.tv_nsec / 1000000000L;
+      ts.tv_nsec %= 1000000000L;
+      pthread_cond_timedwait (&g_wake, &g_lock, &ts);
+
+      pthread_mutex_unlock (&g_lock);
+      drain ();
+      pthread_mutex_lock (&g_lock);
+    }
+  pthread_mutex_unlock (&g_lock);
+  return NULL;
+}
+
+int
+trace_start (const char *path)
+{
+  g_out = fopen (path, "w");
+  if (g_out == NULL)
+    return -1;
+
+  g_pid = getpid ();
+  if (pthread_create (&g_writer, NULL, writer, NULL) != 0)
+    {
+      fclose (g_out);
+      g_out = NULL;
+      return -1;
+    }
+
+  __atomic_store_n (&g_tracing, true, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void
+trace_stop ()
+{
+  struct trace_buffer *b;
+  unsigned long dropped = 0;
+
+  if (g_out == NULL)
+    return;
+
+  __atomic_store_n (&g_tracing, false, __ATOMIC_RELEASE);
+  pthread_mutex_lock (&g_lock);
+  g_stopping = true;
+  pthread_cond_signal (&g_wake);
+  pthread_mutex_unlock (&g_lock);
+  pthread_join (g_writer, NULL);
+
+  drain ();
+  for (b = g_buffers; b; b = b->next)
+    dropped += b->dropped;
+  if (dropped)
+    fprintf (stderr, "Trace: %lu events dropped\n", dropped);
+
+  fputs (g_first ? "[]\n" : "\n]\n", g_out);
+  fclose (g_out);
+  g_out = NULL;
+}
+
+long long
+trace_begin ()
+{
+  return __atomic_load_n (&g_tracing, __ATOMIC_RELAXED) ? now_us () : 0;
+}
+
+void
+trace_end (const char *name, long long start)
+{
+  if (start && __atomic_load_n (&g_tracing, __ATOMIC_RELAXED))
+    push (name, 'X', start, now_us () - start, 0);
+}
+
+void
+trace_async_begin (const char *name, const void *id)
+{
+  if (__atomic_load_n (&g_tracing, __ATOMIC_RELAXED))
+    push (name, 'b', now_us (), 0, (uintptr_t) id);
+}
+
+void
+trace_async_end (const char *name, const void *id)
+{
+  if (__atomic_load_n (&g_tracing, __ATOMIC_RELAXED))
+    push (name, 'e', now_us (), 0, (uintptr_t) id);
+}
+
+void
+trace_instant (const char *name)
+{
+  if (__atomic_load_n (&g_tracing, __ATOMIC_RELAXED))
+    push (name, 'i', now_us (), 0, 0);
+}